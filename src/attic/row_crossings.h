@@ -0,0 +1,137 @@
+/*
+Copyright (c) 2013, Regents of the University of Alaska
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of the Geographic Information Network of Alaska nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+This code was developed by Dan Stahlke for the Geographic Information Network of Alaska.
+*/
+
+
+
+// The get_row_crossings (polygon-rasterizer.h) that worked out the crossings
+// of each row in a vector of its own.  Kept so that bench_row_crossings can
+// compare it with the edge table sweep.
+
+#ifndef DANGDAL_ATTIC_ROW_CROSSINGS_H
+#define DANGDAL_ATTIC_ROW_CROSSINGS_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "../common.h"
+#include "../polygon.h"
+#include "../polygon-rasterizer.h"
+
+namespace dangdal {
+namespace attic {
+
+typedef std::vector<double> row_crossings_dbl_t;
+
+inline void crossings_dbl_to_int(const row_crossings_dbl_t &in, row_crossings_t &out) {
+	static const double EPSILON = 1e-9;
+	out.clear();
+	for(size_t i=0; i<in.size(); i+=2) {
+		int from = (int)ceil(in[i] - EPSILON);
+		int to = (int)floor(in[i+1] + EPSILON);
+		if(to > from) {
+			out.push_back(from);
+			out.push_back(to);
+		}
+	}
+}
+
+
+// This function returns a list of pixel ranges for each row.  The ranges
+// consist of pixels that are entirely contained within the polygon.  The
+// results will be slightly wrong for polygons whose vertices are not integers.
+inline std::vector<row_crossings_t> get_row_crossings(
+	const Mpoly &mpoly, int min_y, int num_rows
+) {
+	std::vector<row_crossings_dbl_t> rows_top(num_rows);
+	std::vector<row_crossings_dbl_t> rows_bot(num_rows);
+
+	for(size_t i=0; i<mpoly.rings.size(); i++) {
+		const Ring &c = mpoly.rings[i];
+		size_t npts = c.pts.size();
+		for(size_t j=0; j<npts; j++) {
+			size_t j_plus1 = (j==npts-1) ? 0 : (j+1);
+			double x0 = c.pts[j].x;
+			double y0 = c.pts[j].y;
+			double x1 = c.pts[j_plus1].x;
+			double y1 = c.pts[j_plus1].y;
+			if(y0 == y1) continue;
+			if(y0 > y1) {
+				double tmp;
+				tmp=x0; x0=x1; x1=tmp; 
+				tmp=y0; y0=y1; y1=tmp; 
+			}
+			double alpha = (x1-x0) / (y1-y0);
+			int y0i = (int)round(y0);
+			int y1i = (int)round(y1);
+			// only the rows min_y-1 .. min_y+num_rows are of interest
+			int y_from = std::max(y0i, min_y);
+			int y_to = std::min(y1i, min_y + num_rows);
+			for(int y=y_from; y<=y_to; y++) {
+				double x = x0 + ((double)y - y0)*alpha;
+
+				int row = y - min_y - 1;
+				if(y > y0i && row >= 0 && row < num_rows) {
+					row_crossings_dbl_t &r = rows_bot[row];
+					r.push_back(x);
+				}
+
+				row = y - min_y;
+				if(y < y1i && row >= 0 && row < num_rows) {
+					row_crossings_dbl_t &r = rows_top[row];
+					r.push_back(x);
+				}
+			}
+		}
+	}
+
+	std::vector<row_crossings_t> rows_out(num_rows);
+
+	for(int row=0; row<num_rows; row++) {
+		std::sort(rows_top[row].begin(), rows_top[row].end());
+		std::sort(rows_bot[row].begin(), rows_bot[row].end());
+		row_crossings_t top, bot;
+		crossings_dbl_to_int(rows_top[row], top);
+		crossings_dbl_to_int(rows_bot[row], bot);
+		if(top.size() && bot.size()) {
+			row_crossings_t c = crossings_intersection(top, bot);
+			std::swap(rows_out[row], c);
+		} else if(!top.empty()) {
+			std::swap(rows_out[row], top);
+		} else if(!bot.empty()) {
+			std::swap(rows_out[row], bot);
+		} else {
+			// no-op: leave rows_out[row] empty
+		}
+	}
+
+	return rows_out;
+}
+
+} // namespace attic
+} // namespace dangdal
+
+#endif // ifndef DANGDAL_ATTIC_ROW_CROSSINGS_H
@@ -0,0 +1,94 @@
+/*
+Copyright (c) 2013, Regents of the University of Alaska
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of the Geographic Information Network of Alaska nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+This code was developed by Dan Stahlke for the Geographic Information Network of Alaska.
+*/
+
+
+
+// Helpers shared by the bench_* microbenchmarks (see "make bench").
+
+#ifndef DANGDAL_BENCH_H
+#define DANGDAL_BENCH_H
+
+#include <algorithm>
+
+#include <sys/time.h>
+
+#include "common.h"
+#include "mask.h"
+
+namespace dangdal {
+
+// Wall clock time in seconds.
+inline double bench_now() {
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// A xorshift generator, so that the input is the same on every platform.
+class BenchRandom {
+public:
+	explicit BenchRandom(uint32_t seed) : state(seed | 1) { }
+
+	uint32_t next() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+private:
+	uint32_t state;
+};
+
+// Blobs, with one pixel in ten of each left out, on a background with one
+// pixel in ten set.  Traced, this gives lots of small rings as well as some
+// big ones.
+inline BitGrid bench_random_mask(int w, int h, BenchRandom &rnd) {
+	BitGrid mask(w, h);
+	mask.zero();
+	for(int y=0; y<h; y++) {
+		for(int x=0; x<w; x++) {
+			if(rnd.next() % 10 == 0) mask.set(x, y, true);
+		}
+	}
+	int num_blobs = std::max(1, w / 20);
+	for(int i=0; i<num_blobs; i++) {
+		int cx = rnd.next() % w;
+		int cy = rnd.next() % h;
+		int r = rnd.next() % (std::max(w, h) / 10 + 1) + 1;
+		for(int y=std::max(0, cy-r); y<std::min(h, cy+r); y++) {
+			for(int x=std::max(0, cx-r); x<std::min(w, cx+r); x++) {
+				if((x-cx)*(x-cx) + (y-cy)*(y-cy) >= r*r) continue;
+				mask.set(x, y, rnd.next() % 10 != 0);
+			}
+		}
+	}
+	return mask;
+}
+
+} // namespace dangdal
+
+#endif // ifndef DANGDAL_BENCH_H
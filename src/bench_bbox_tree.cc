@@ -0,0 +1,137 @@
+/*
+Copyright (c) 2013, Regents of the University of Alaska
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of the Geographic Information Network of Alaska nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+This code was developed by Dan Stahlke for the Geographic Information Network of Alaska.
+*/
+
+
+
+// Times BboxRTree against the BboxBinarySpacePartition it replaced
+// (attic/bbox_bsp.h), on the segments of the rings traced from a random mask
+// of noisy blobs, as fix_topology uses it: the tree is built from the bbox of
+// every segment and then queried with each of them.  Also checks that both
+// trees find the same items.
+//
+// Usage: bench_bbox_tree [width height [seed [segment_length [node_size]]]]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+#include "bench.h"
+#include "polygon.h"
+#include "mask.h"
+#include "mask-tracer.h"
+#include "attic/bbox_bsp.h"
+
+using namespace dangdal;
+
+typedef std::pair<size_t, size_t> SegId;
+
+static const int NUM_PASSES = 5;
+
+struct CountingVisitor {
+	CountingVisitor() : count(0) { }
+	void operator()(const SegId &) { count++; }
+	size_t count;
+};
+
+int main(int argc, char **argv) {
+	int w = 2000, h = 2000;
+	size_t seg_len = 1;
+	size_t node_size = 8;
+	uint32_t seed = 12345;
+	if(argc == 2 || argc > 6) fatal_error(
+		"Usage: %s [width height [seed [segment_length [node_size]]]]", argv[0]);
+	if(argc > 2) {
+		w = atoi(argv[1]);
+		h = atoi(argv[2]);
+	}
+	if(argc > 3) seed = atoi(argv[3]);
+	if(argc > 4) seg_len = atoi(argv[4]);
+	if(argc > 5) node_size = atoi(argv[5]);
+	if(w < 1 || h < 1 || seg_len < 1) fatal_error("width, height and segment length must be positive");
+
+	BenchRandom rnd(seed);
+	BitGrid mask = bench_random_mask(w, h, rnd);
+	Mpoly mp = trace_mask(mask, w, h, 0, false);
+
+	// Each item covers seg_len edges of a ring.
+	std::vector<std::pair<Bbox, SegId> > items;
+	for(size_t r_idx=0; r_idx<mp.rings.size(); r_idx++) {
+		const std::vector<Vertex> &pts = mp.rings[r_idx].pts;
+		for(size_t i=0; i<pts.size(); i+=seg_len) {
+			Bbox bbox;
+			for(size_t j=i; j<=i+seg_len && j<=pts.size(); j++) {
+				bbox.expand(pts[j % pts.size()]);
+			}
+			items.push_back(std::make_pair(bbox, SegId(r_idx, i)));
+		}
+	}
+
+	// The best of a few passes, to keep out the noise.
+	double bsp_build = 0, rtree_build = 0, bsp_query = 0, rtree_query = 0;
+	size_t bsp_hits = 0, rtree_hits = 0;
+	for(int pass=0; pass<NUM_PASSES; pass++) {
+		double t0 = bench_now();
+		attic::BboxBinarySpacePartition<SegId> bsp(items);
+		double t1 = bench_now();
+		BboxRTree<SegId> rtree(items, node_size);
+		double t2 = bench_now();
+		bsp_hits = 0;
+		for(size_t i=0; i<items.size(); i++) {
+			bsp_hits += bsp.get_intersecting_items(items[i].first).size();
+		}
+		double t3 = bench_now();
+		CountingVisitor visitor;
+		for(size_t i=0; i<items.size(); i++) {
+			rtree.visit_intersecting_items(items[i].first, visitor);
+		}
+		double t4 = bench_now();
+		rtree_hits = visitor.count;
+		if(pass == 0 || t1-t0 < bsp_build) bsp_build = t1-t0;
+		if(pass == 0 || t2-t1 < rtree_build) rtree_build = t2-t1;
+		if(pass == 0 || t3-t2 < bsp_query) bsp_query = t3-t2;
+		if(pass == 0 || t4-t3 < rtree_query) rtree_query = t4-t3;
+	}
+
+	attic::BboxBinarySpacePartition<SegId> bsp(items);
+	BboxRTree<SegId> rtree(items, node_size);
+	size_t bad = 0;
+	for(size_t i=0; i<items.size(); i++) {
+		std::vector<SegId> want = bsp.get_intersecting_items(items[i].first);
+		std::vector<SegId> got = rtree.get_intersecting_items(items[i].first);
+		std::sort(want.begin(), want.end());
+		std::sort(got.begin(), got.end());
+		if(want != got) bad++;
+	}
+
+	printf("%zd items: build bsp %.3f s, rtree %.3f s; query bsp %.3f s, rtree %.3f s; %zd mismatches\n",
+		items.size(), bsp_build, rtree_build, bsp_query, rtree_query, bad);
+	if(bsp_hits != rtree_hits) fatal_error("hit counts differ");
+
+	return bad ? 1 : 0;
+}
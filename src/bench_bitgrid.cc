@@ -0,0 +1,175 @@
+/*
+Copyright (c) 2013, Regents of the University of Alaska
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of the Geographic Information Network of Alaska nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+This code was developed by Dan Stahlke for the Geographic Information Network of Alaska.
+*/
+
+
+
+// Times the bit-packed BitGrid against the GridArray<bool> one it replaced
+// (attic/bitgrid.h): invert, erode, centroid, and tracing (with the tracer
+// that went with each).  The input is a random mask of noisy blobs, with
+// the given fraction of pixels set.  Also checks that both give the same
+// masks, centroids and rings.
+//
+// Usage: bench_bitgrid [width height [seed [fill]]]
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "common.h"
+#include "bench.h"
+#include "polygon.h"
+#include "mask.h"
+#include "mask-tracer.h"
+#include "attic/bitgrid.h"
+
+using namespace dangdal;
+
+static const int NUM_PASSES = 3;
+
+static bool same_bits(const BitGrid &a, const attic::BitGrid &b, int w, int h) {
+	for(int y=0; y<h; y++) {
+		for(int x=0; x<w; x++) {
+			if(a(x, y) != b(x, y)) return false;
+		}
+	}
+	return true;
+}
+
+static bool same_rings(const Mpoly &a, const Mpoly &b) {
+	if(a.rings.size() != b.rings.size()) return false;
+	for(size_t i=0; i<a.rings.size(); i++) {
+		const Ring &ra = a.rings[i];
+		const Ring &rb = b.rings[i];
+		if(ra.parent_id != rb.parent_id || ra.is_hole != rb.is_hole) return false;
+		if(ra.pts.size() != rb.pts.size()) return false;
+		for(size_t j=0; j<ra.pts.size(); j++) {
+			if(ra.pts[j].x != rb.pts[j].x || ra.pts[j].y != rb.pts[j].y) return false;
+		}
+	}
+	return true;
+}
+
+static void report(const char *what, double old_time, double new_time, bool ok) {
+	printf("%-9s old %.4f s, new %.4f s%s\n", what, old_time, new_time, ok ? "" : ", MISMATCH");
+}
+
+// keeps the best time of the passes
+static void keep_best(int pass, double t, double &best) {
+	if(pass == 0 || t < best) best = t;
+}
+
+int main(int argc, char **argv) {
+	int w = 2000, h = 2000;
+	uint32_t seed = 12345;
+	double fill = 0.8;
+	if(argc == 2 || argc > 5) fatal_error("Usage: %s [width height [seed [fill]]]", argv[0]);
+	if(argc > 2) {
+		w = atoi(argv[1]);
+		h = atoi(argv[2]);
+	}
+	if(argc > 3) seed = atoi(argv[3]);
+	if(argc > 4) fill = atof(argv[4]);
+	if(w < 1 || h < 1) fatal_error("width and height must be positive");
+
+	// Blobs for the tracer to find holes in, with fill of the pixels outside
+	// of them set at random.
+	BenchRandom rnd(seed);
+	BitGrid mask = bench_random_mask(w, h, rnd);
+	for(int y=0; y<h; y++) {
+		for(int x=0; x<w; x++) {
+			if(!mask(x, y) && rnd.next() % 1000 < fill * 1000) mask.set(x, y, true);
+		}
+	}
+	attic::BitGrid old_mask(w, h);
+	for(int y=0; y<h; y++) {
+		for(int x=0; x<w; x++) {
+			old_mask.set(x, y, mask(x, y));
+		}
+	}
+	printf("%dx%d, %zd pixels set\n", w, h, mask.count());
+	int bad = 0;
+
+	double old_time = 0, new_time = 0;
+	for(int pass=0; pass<NUM_PASSES; pass++) {
+		double t0 = bench_now();
+		old_mask.invert();
+		double t1 = bench_now();
+		mask.invert();
+		double t2 = bench_now();
+		keep_best(pass, t1-t0, old_time);
+		keep_best(pass, t2-t1, new_time);
+	}
+	bool ok = same_bits(mask, old_mask, w, h);
+	report("invert", old_time, new_time, ok);
+	bad += !ok;
+
+	for(int pass=0; pass<NUM_PASSES; pass++) {
+		attic::BitGrid old_eroded = old_mask;
+		BitGrid eroded = mask;
+		double t0 = bench_now();
+		old_eroded.erode();
+		double t1 = bench_now();
+		eroded.erode();
+		double t2 = bench_now();
+		keep_best(pass, t1-t0, old_time);
+		keep_best(pass, t2-t1, new_time);
+		if(pass == 0) ok = same_bits(eroded, old_eroded, w, h);
+	}
+	report("erode", old_time, new_time, ok);
+	bad += !ok;
+
+	Vertex old_c, new_c;
+	for(int pass=0; pass<NUM_PASSES; pass++) {
+		double t0 = bench_now();
+		old_c = old_mask.centroid();
+		double t1 = bench_now();
+		new_c = mask.centroid();
+		double t2 = bench_now();
+		keep_best(pass, t1-t0, old_time);
+		keep_best(pass, t2-t1, new_time);
+	}
+	ok = old_c.x == new_c.x && old_c.y == new_c.y;
+	report("centroid", old_time, new_time, ok);
+	bad += !ok;
+
+	// The old tracer erases the mask as it goes, so it gets a copy.
+	Mpoly old_mp, new_mp;
+	for(int pass=0; pass<NUM_PASSES; pass++) {
+		attic::BitGrid old_copy = old_mask;
+		double t0 = bench_now();
+		old_mp = attic::trace_mask(old_copy, w, h, 0, false);
+		double t1 = bench_now();
+		new_mp = trace_mask(mask, w, h, 0, false);
+		double t2 = bench_now();
+		keep_best(pass, t1-t0, old_time);
+		keep_best(pass, t2-t1, new_time);
+	}
+	ok = same_rings(old_mp, new_mp);
+	report("trace", old_time, new_time, ok);
+	bad += !ok;
+
+	return bad ? 1 : 0;
+}
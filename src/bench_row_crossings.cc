@@ -0,0 +1,160 @@
+/*
+Copyright (c) 2013, Regents of the University of Alaska
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of the Geographic Information Network of Alaska nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+This code was developed by Dan Stahlke for the Geographic Information Network of Alaska.
+*/
+
+
+
+// Times get_row_crossings against the version it replaced (attic/row_crossings.h),
+// called the way the tracer calls it: on each traced ring, over the rows of its
+// bounding box.  The input is a random mask of noisy blobs, which gives lots of
+// small rings as well as some big ones.  Also checks that both versions give
+// the same crossings, including with rows to spare above and below each ring,
+// with coordinates that aren't integers, and for the whole multipolygon at once.
+//
+// Usage: bench_row_crossings [width height [seed]]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <boost/foreach.hpp>
+
+#include "common.h"
+#include "bench.h"
+#include "polygon.h"
+#include "polygon-rasterizer.h"
+#include "mask.h"
+#include "mask-tracer.h"
+#include "attic/row_crossings.h"
+
+using namespace dangdal;
+
+static const int NUM_PASSES = 5;
+
+static bool same_crossings(const Mpoly &mp, int min_y, int num_rows) {
+	std::vector<row_crossings_t> want = attic::get_row_crossings(mp, min_y, num_rows);
+	RowCrossingsTable got = get_row_crossings(mp, min_y, num_rows);
+	if(got.num_rows() != want.size()) return false;
+	for(size_t i=0; i<want.size(); i++) {
+		if(got.row_size(i) != want[i].size()) return false;
+		if(!std::equal(want[i].begin(), want[i].end(), got.row(i))) return false;
+	}
+	return true;
+}
+
+// Gives the best time of a few passes over the given rings, to keep out the
+// noise.
+static void time_rings(const char *what, const std::vector<Mpoly> &ring_mps,
+	std::vector<Bbox> &bboxes, const std::vector<size_t> &which
+) {
+	double old_time = 0, new_time = 0;
+	size_t num_rows = 0;
+	for(int pass=0; pass<NUM_PASSES; pass++) {
+		double t0 = bench_now();
+		size_t old_rows = 0;
+		BOOST_FOREACH(size_t i, which) {
+			old_rows += attic::get_row_crossings(ring_mps[i],
+				int(bboxes[i].min_y), int(bboxes[i].height())).size();
+		}
+		double t1 = bench_now();
+		num_rows = 0;
+		BOOST_FOREACH(size_t i, which) {
+			num_rows += get_row_crossings(ring_mps[i],
+				int(bboxes[i].min_y), int(bboxes[i].height())).num_rows();
+		}
+		double t2 = bench_now();
+		if(old_rows != num_rows) fatal_error("row counts differ");
+		if(pass == 0 || t1-t0 < old_time) old_time = t1-t0;
+		if(pass == 0 || t2-t1 < new_time) new_time = t2-t1;
+	}
+	printf("%zd %s rings, %zd rows: old %.3f s, new %.3f s\n",
+		which.size(), what, num_rows, old_time, new_time);
+}
+
+// Each ring is checked over its bounding box plus a few rows.
+static size_t count_mismatches(const std::vector<Mpoly> &ring_mps, const Mpoly &whole, int h) {
+	size_t bad = 0;
+	for(size_t i=0; i<ring_mps.size(); i++) {
+		Bbox bbox = ring_mps[i].getBbox();
+		if(!same_crossings(ring_mps[i], int(floor(bbox.min_y)) - 2, int(bbox.height()) + 5)) bad++;
+	}
+	if(!same_crossings(whole, -3, h + 6)) bad++;
+	return bad;
+}
+
+int main(int argc, char **argv) {
+	int w = 2000, h = 2000;
+	uint32_t seed = 12345;
+	if(argc == 3 || argc == 4) {
+		w = atoi(argv[1]);
+		h = atoi(argv[2]);
+		if(argc == 4) seed = atoi(argv[3]);
+	} else if(argc != 1) {
+		fatal_error("Usage: %s [width height [seed]]", argv[0]);
+	}
+	if(w < 1 || h < 1) fatal_error("width and height must be positive");
+
+	BenchRandom rnd(seed);
+	BitGrid mask = bench_random_mask(w, h, rnd);
+	Mpoly whole = trace_mask(mask, w, h, 0, false);
+
+	std::vector<Mpoly> ring_mps(whole.rings.size());
+	std::vector<Bbox> bboxes(whole.rings.size());
+	for(size_t i=0; i<whole.rings.size(); i++) {
+		ring_mps[i].rings.push_back(whole.rings[i]);
+		bboxes[i] = whole.rings[i].getBbox();
+	}
+
+	// Single row rings, which most of the rings from a noisy mask are, are
+	// timed apart from the rest.
+	std::vector<size_t> short_rings, tall_rings;
+	for(size_t i=0; i<ring_mps.size(); i++) {
+		if(bboxes[i].height() <= 1) {
+			short_rings.push_back(i);
+		} else {
+			tall_rings.push_back(i);
+		}
+	}
+	time_rings("single row", ring_mps, bboxes, short_rings);
+	time_rings("taller", ring_mps, bboxes, tall_rings);
+
+	size_t bad = count_mismatches(ring_mps, whole, h);
+
+	// Once more, with coordinates that aren't integers.
+	for(size_t i=0; i<ring_mps.size(); i++) {
+		std::vector<Vertex> &pts = ring_mps[i].rings[0].pts;
+		for(size_t j=0; j<pts.size(); j++) {
+			pts[j].x = pts[j].x * 1.7 + 0.3;
+			pts[j].y = pts[j].y * 1.7 + 0.21;
+			whole.rings[i].pts[j] = pts[j];
+		}
+	}
+	bad += count_mismatches(ring_mps, whole, int(h * 1.7) + 1);
+
+	printf("%zd mismatches\n", bad);
+
+	return bad ? 1 : 0;
+}
@@ -27,6 +27,9 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 
 
 #include <cassert>
+#include <algorithm>
+
+#include <boost/thread.hpp>
 
 #include "common.h"
 #include "polygon.h"
@@ -72,41 +75,192 @@ private:
 	const Mpoly *mp;
 };
 
-class RingsComparator {
-public:
-	explicit RingsComparator(Mpoly *_mp) : mp(_mp) { }
+// A vertex on an integer lattice, with its coordinates packed into a key that
+// sorts the same way as CoordsComparator.  The index counts vertices through
+// all rings in order, so that it too sorts the same way.
+struct LatticeVert {
+	uint64_t key;
+	size_t idx;
+};
 
-	bool operator()(const VertRef &a, const VertRef &b) const {
-		return
-			a.ring_idx < b.ring_idx ? true :
-			a.ring_idx > b.ring_idx ? false :
-			a.vert_idx < b.vert_idx ? true :
-			false;
+static inline bool lattice_vert_less(const LatticeVert &a, const LatticeVert &b) {
+	return a.key < b.key || (a.key == b.key && a.idx < b.idx);
+}
+
+static const int RADIX_BITS = 8;
+static const size_t RADIX_SIZE = size_t(1) << RADIX_BITS;
+
+// Stable sort of [begin, end) by the key bits below key_bits, using tmp (the
+// same size as the input) as scratch space.  Since the input is already in
+// order of index, stability makes it come out in the same order as
+// lattice_vert_less.
+static void radix_sort_lattice_verts(
+	LatticeVert *begin, LatticeVert *end, LatticeVert *tmp, int key_bits
+) {
+	size_t n = end - begin;
+	if(n < 64) {
+		// not worth making histograms for
+		std::sort(begin, end, lattice_vert_less);
+		return;
 	}
+	LatticeVert *src = begin, *dst = tmp;
+	std::vector<size_t> pos(RADIX_SIZE);
+	for(int shift=0; shift<key_bits; shift+=RADIX_BITS) {
+		std::fill(pos.begin(), pos.end(), 0);
+		for(size_t i=0; i<n; i++) pos[(src[i].key >> shift) & (RADIX_SIZE-1)]++;
+		size_t total = 0;
+		for(size_t d=0; d<RADIX_SIZE; d++) {
+			size_t cnt = pos[d];
+			pos[d] = total;
+			total += cnt;
+		}
+		for(size_t i=0; i<n; i++) dst[pos[(src[i].key >> shift) & (RADIX_SIZE-1)]++] = src[i];
+		std::swap(src, dst);
+	}
+	if(src != begin) std::copy(src, src+n, begin);
+}
 
-private:
-	const Mpoly *mp;
+// The vertices are first split into buckets by the top bits of their keys.
+// Each bucket is then sorted and searched for duplicates on its own, by
+// however many threads are available.
+struct LatticeBuckets {
+	LatticeBuckets() : low_bits(0), next(0), num_touch(0), triple(false) { }
+
+	std::vector<LatticeVert> verts;
+	std::vector<LatticeVert> tmp;
+	// bucket i is verts[bucket_begin[i]] through verts[bucket_begin[i+1]-1]
+	std::vector<size_t> bucket_begin;
+	// number of key bits not used to pick the bucket
+	int low_bits;
+	// touched[idx] is set for the first of each pair of vertices that touch
+	std::vector<uint8_t> touched;
+
+	// guards the following
+	boost::mutex lock;
+	size_t next;
+	size_t num_touch;
+	bool triple;
 };
 
-static inline double sgn(double v) {
-	return v<0 ? -1 : v>0 ? 1 : 0;
+static void lattice_bucket_worker(LatticeBuckets *lb) {
+	size_t num_touch = 0;
+	bool triple = false;
+	for(;;) {
+		size_t b_idx;
+		{
+			boost::mutex::scoped_lock l(lb->lock);
+			b_idx = lb->next++;
+		}
+		if(b_idx+1 >= lb->bucket_begin.size()) break;
+
+		size_t begin = lb->bucket_begin[b_idx];
+		size_t end = lb->bucket_begin[b_idx+1];
+		if(end - begin < 2) continue;
+		radix_sort_lattice_verts(&lb->verts[begin], &lb->verts[0] + end,
+			&lb->tmp[begin], lb->low_bits);
+
+		bool prev_was_same = 0;
+		for(size_t i=begin; i<end-1; i++) {
+			if(lb->verts[i].key == lb->verts[i+1].key) {
+				if(prev_was_same) triple = true;
+				lb->touched[lb->verts[i].idx] = 1;
+				num_touch++;
+				prev_was_same = 1;
+			} else {
+				prev_was_same = 0;
+			}
+		}
+	}
+
+	boost::mutex::scoped_lock l(lb->lock);
+	lb->num_touch += num_touch;
+	if(triple) lb->triple = true;
 }
 
-// This function is only meant to be called on polygons
-// that have orthogonal sides on an integer lattice.
-void bevel_self_intersections(Mpoly &mp, double amount) {
-	if(VERBOSE) {
-		printf("Beveling\n");
-	} else {
-		printf("Beveling: ");
-		GDALTermProgress(0, NULL, NULL);
+static size_t bits_needed(uint64_t v) {
+	size_t bits = 0;
+	while(v) { bits++; v >>= 1; }
+	return bits;
+}
+
+// Traced polygons have their vertices on an integer lattice, which allows
+// finding the touching vertices by radix sort rather than by comparison sort.
+// Returns false, having done nothing, if the vertices aren't on a lattice
+// small enough for the coordinates to fit in a 64 bit key.
+static bool find_touches_on_lattice(
+	const Mpoly &mp, size_t total_pts, int num_threads,
+	std::vector<uint8_t> &touched, size_t &num_touch
+) {
+	Bbox bbox = mp.getBbox();
+	for(size_t r_idx=0; r_idx<mp.rings.size(); r_idx++) {
+		const Ring &ring = mp.rings[r_idx];
+		for(size_t v_idx=0; v_idx<ring.pts.size(); v_idx++) {
+			const Vertex &v = ring.pts[v_idx];
+			// this is also false for NaN
+			if(!(v.x == floor(v.x) && v.y == floor(v.y))) return false;
+		}
 	}
+	const double max_range = double(uint64_t(1) << 62);
+	if(!(bbox.max_x - bbox.min_x < max_range && bbox.max_y - bbox.min_y < max_range)) return false;
+	int y_bits = bits_needed(uint64_t(bbox.max_y - bbox.min_y));
+	int key_bits = bits_needed(uint64_t(bbox.max_x - bbox.min_x)) + y_bits;
+	if(key_bits > 64) return false;
 
-	size_t total_pts = 0;
-	for(size_t i=0; i<mp.rings.size(); i++) {
-		total_pts += mp.rings[i].pts.size();
+	if(VERBOSE) printf("allocating %zd megs for beveler\n",
+		(2*total_pts*sizeof(LatticeVert)) >> 20);
+	LatticeBuckets lb;
+	lb.verts.resize(total_pts);
+	lb.tmp.resize(total_pts);
+	lb.touched.resize(total_pts, 0);
+	lb.low_bits = std::max(key_bits - RADIX_BITS, 0);
+
+	// Make the keys, and sort them into buckets by their top bits.
+	std::vector<size_t> &pos = lb.bucket_begin;
+	pos.resize(RADIX_SIZE+1, 0);
+	size_t idx = 0;
+	for(size_t r_idx=0; r_idx<mp.rings.size(); r_idx++) {
+		const Ring &ring = mp.rings[r_idx];
+		for(size_t v_idx=0; v_idx<ring.pts.size(); v_idx++) {
+			const Vertex &v = ring.pts[v_idx];
+			LatticeVert &lv = lb.tmp[idx];
+			lv.key =
+				(uint64_t(v.x - bbox.min_x) << y_bits) |
+				 uint64_t(v.y - bbox.min_y);
+			lv.idx = idx++;
+			pos[(lv.key >> lb.low_bits) + 1]++;
+		}
+	}
+	for(size_t d=0; d<RADIX_SIZE; d++) pos[d+1] += pos[d];
+	for(size_t i=0; i<total_pts; i++) {
+		const LatticeVert &lv = lb.tmp[i];
+		lb.verts[pos[lv.key >> lb.low_bits]++] = lv;
 	}
+	// pos[d] now holds the end of bucket d rather than its beginning
+	for(size_t d=RADIX_SIZE; d>0; d--) pos[d] = pos[d-1];
+	pos[0] = 0;
+	term_progress(0.3);
+
+	size_t num_workers = std::max(num_threads, 1);
+	boost::thread_group threads;
+	for(size_t i=1; i<num_workers; i++) {
+		threads.add_thread(new boost::thread(lattice_bucket_worker, &lb));
+	}
+	lattice_bucket_worker(&lb);
+	threads.join_all();
+
+	if(lb.triple) {
+		fatal_error("should not have triple intersections in beveler");
+	}
+	touched.swap(lb.touched);
+	num_touch = lb.num_touch;
+	return true;
+}
 
+// This is the general way, for when the vertices aren't on a lattice.
+static size_t find_touches_by_sorting(
+	Mpoly &mp, size_t total_pts, std::vector<size_t> &ring_begin,
+	std::vector<uint8_t> &touched
+) {
 	if(VERBOSE) printf("allocating %zd megs for beveler\n",
 		(total_pts*sizeof(VertRef)) >> 20);
 	std::vector<VertRef> entries;
@@ -114,20 +268,14 @@ void bevel_self_intersections(Mpoly &mp, double amount) {
 	for(size_t r_idx=0; r_idx<mp.rings.size(); r_idx++) {
 		const Ring &ring = mp.rings[r_idx];
 		for(size_t v_idx=0; v_idx<ring.pts.size(); v_idx++) {
-			if(VERBOSE >= 2) {
-				printf("mp[%zd][%zd] = %g, %g\n", r_idx, v_idx,
-					ring.pts[v_idx].x, ring.pts[v_idx].y);
-			}
 			entries.push_back(VertRef(r_idx, v_idx));
 		}
 	}
 	assert(total_pts == entries.size());
 
-	if(VERBOSE) printf("finding self-intersections\n");
-	GDALTermProgress(0.1, NULL, NULL);
 	// sort by x,y
 	std::sort(entries.begin(), entries.end(), CoordsComparator(&mp));
-	GDALTermProgress(0.8, NULL, NULL);
+	term_progress(0.7);
 
 	if(VERBOSE >= 2) {
 		printf("\nbefore grep:\n");
@@ -140,12 +288,10 @@ void bevel_self_intersections(Mpoly &mp, double amount) {
 		}
 	}
 
-	size_t total_num_touch = 0;
+	touched.assign(total_pts, 0);
+	size_t num_touch = 0;
 	bool prev_was_same = 0;
-	for(size_t i=0; i<total_pts-1; i++) {
-		//printf("%lf %lf %zd %zd\n",
-		//	entries[i].x, entries[i].y,
-		//	entries[i].ring_idx, entries[i].vert_idx);
+	for(size_t i=0; i+1<total_pts; i++) {
 		const Vertex &va = entries[i  ].getVert(mp);
 		const Vertex &vb = entries[i+1].getVert(mp);
 		if(
@@ -155,23 +301,75 @@ void bevel_self_intersections(Mpoly &mp, double amount) {
 			if(prev_was_same) {
 				fatal_error("should not have triple intersections in beveler");
 			}
-			entries[total_num_touch++] = entries[i];
+			touched[ring_begin[entries[i].ring_idx] + entries[i].vert_idx] = 1;
+			num_touch++;
 			prev_was_same = 1;
 		} else {
 			prev_was_same = 0;
 		}
 	}
+	return num_touch;
+}
+
+static inline double sgn(double v) {
+	return v<0 ? -1 : v>0 ? 1 : 0;
+}
+
+// This function is only meant to be called on polygons
+// that have orthogonal sides on an integer lattice.
+void bevel_self_intersections(Mpoly &mp, double amount, int num_threads) {
+	if(VERBOSE) {
+		status_printf("Beveling\n");
+	} else {
+		status_printf("Beveling: ");
+		term_progress(0);
+	}
+
+	// index of each ring's first vertex, counting through all rings
+	std::vector<size_t> ring_begin(mp.rings.size());
+	size_t total_pts = 0;
+	for(size_t i=0; i<mp.rings.size(); i++) {
+		ring_begin[i] = total_pts;
+		total_pts += mp.rings[i].pts.size();
+	}
+
+	if(VERBOSE >= 2) {
+		for(size_t r_idx=0; r_idx<mp.rings.size(); r_idx++) {
+			const Ring &ring = mp.rings[r_idx];
+			for(size_t v_idx=0; v_idx<ring.pts.size(); v_idx++) {
+				printf("mp[%zd][%zd] = %g, %g\n", r_idx, v_idx,
+					ring.pts[v_idx].x, ring.pts[v_idx].y);
+			}
+		}
+	}
+
+	if(VERBOSE) printf("finding self-intersections\n");
+	term_progress(0.1);
+	std::vector<uint8_t> touched;
+	size_t total_num_touch = 0;
+	if(!find_touches_on_lattice(mp, total_pts, num_threads, touched, total_num_touch)) {
+		total_num_touch = find_touches_by_sorting(mp, total_pts, ring_begin, touched);
+	}
+	term_progress(0.8);
 
 	if(VERBOSE) printf("found %zd self-intersections\n", total_num_touch);
 	if(!total_num_touch) {
-		GDALTermProgress(1, NULL, NULL);
+		term_progress(1);
 		if(VERBOSE) printf("beveler finish\n");
 		return;
 	}
 
-	entries.resize(total_num_touch);
-	// sort by ring_idx,vert_idx
-	std::sort(entries.begin(), entries.end(), RingsComparator(&mp));
+	// list the touching vertices by ring_idx,vert_idx
+	std::vector<VertRef> entries;
+	entries.reserve(total_num_touch);
+	for(size_t r_idx=0; r_idx<mp.rings.size(); r_idx++) {
+		for(size_t v_idx=0; v_idx<mp.rings[r_idx].pts.size(); v_idx++) {
+			if(touched[ring_begin[r_idx] + v_idx]) {
+				entries.push_back(VertRef(r_idx, v_idx));
+			}
+		}
+	}
+	assert(entries.size() == total_num_touch);
 
 	if(VERBOSE >= 2) {
 		printf("\nafter sort:\n");
@@ -260,7 +458,7 @@ void bevel_self_intersections(Mpoly &mp, double amount) {
 		entry_idx += ring_num_touch;
 	}
 
-	GDALTermProgress(1, NULL, NULL);
+	term_progress(1);
 	if(VERBOSE) printf("beveler finish\n");
 }
 
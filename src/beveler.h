@@ -33,7 +33,9 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 
 namespace dangdal {
 
-void bevel_self_intersections(Mpoly &mp, double amount);
+// With num_threads > 1, the search for touching vertices is split between
+// that many threads.  The result is the same either way.
+void bevel_self_intersections(Mpoly &mp, double amount, int num_threads=1);
 
 } // namespace dangdal
 
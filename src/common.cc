@@ -29,12 +29,17 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 #include <vector>
 #include <string>
 
+#include <boost/thread/tss.hpp>
+
 #include "common.h"
 
 namespace dangdal {
 
 int VERBOSE = 0;
 
+// set (to anything) in threads that shouldn't print progress
+static boost::thread_specific_ptr<bool> thread_quiet;
+
 void fatal_error(const std::string &s) {
 	fprintf(stderr, "\n\nerror:\n%s\n\n", s.c_str());
 	exit(1);
@@ -62,4 +67,22 @@ std::vector<std::string> argv_to_list(int argc, char **argv) {
 	return ret;
 }
 
+void set_thread_quiet(bool quiet) {
+	thread_quiet.reset(quiet ? new bool(true) : NULL);
+}
+
+void term_progress(double complete) {
+	if(thread_quiet.get()) return;
+	GDALTermProgress(complete, NULL, NULL);
+}
+
+void status_printf(const char *fmt, ...) {
+	if(thread_quiet.get()) return;
+
+	va_list argp;
+	va_start(argp, fmt);
+	vprintf(fmt, argp);
+	va_end(argp);
+}
+
 } // namespace dangdal
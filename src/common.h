@@ -84,6 +84,14 @@ void fatal_error(const std::string &s) __attribute__((noreturn));
 void fatal_error(const char *s, ...) __attribute__((noreturn, format(printf, 1, 2)));
 std::vector<std::string> argv_to_list(int argc, char **argv);
 
+// GDALTermProgress keeps static state, so only one thread can be drawing a
+// progress bar.  A thread that works alongside others (such as a -classify
+// feature worker) calls set_thread_quiet(true), after which term_progress and
+// status_printf do nothing in that thread.
+void set_thread_quiet(bool quiet);
+void term_progress(double complete);
+void status_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
 } // namespace dangdal
 
 #endif // ifndef DANGDAL_COMMON_H
@@ -26,9 +26,16 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 
 
 
+#include <algorithm>
 #include <vector>
 #include <utility>
 #include <cassert>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "common.h"
 #include "polygon.h"
@@ -48,7 +55,56 @@ static inline double veclen(double x, double y) {
 	return sqrt(x*x + y*y);
 }
 
-Mpoly compute_reduced_pointset(const Mpoly &in_mpoly, double tolerance) {
+// Rings waiting to be reduced, biggest first so that a big ring isn't left
+// for last while the other threads sit idle.  Each ring's result goes in its
+// own slot, so the output doesn't depend on which thread did what.
+struct ReductionQueue {
+	ReductionQueue(const Mpoly &_mpoly, double _tolerance, std::vector<ReducedRing> &_out) :
+		mpoly(_mpoly), tolerance(_tolerance), out(_out), next(0) { }
+
+	const Mpoly &mpoly;
+	double tolerance;
+	std::vector<ReducedRing> &out;
+	std::vector<size_t> order;
+
+	// guards next
+	boost::mutex lock;
+	size_t next;
+};
+
+struct RingIsBigger {
+	explicit RingIsBigger(const Mpoly &_mpoly) : mpoly(_mpoly) { }
+	bool operator()(size_t a, size_t b) const {
+		return mpoly.rings[a].pts.size() > mpoly.rings[b].pts.size();
+	}
+	const Mpoly &mpoly;
+};
+
+static void reduction_worker(ReductionQueue *q) {
+	// Small rings are handed out several at a time, so that the threads
+	// aren't always waiting on the lock.
+	const size_t min_batch_pts = 4096;
+	for(;;) {
+		size_t begin, end;
+		{
+			boost::mutex::scoped_lock l(q->lock);
+			begin = end = q->next;
+			size_t batch_pts = 0;
+			while(end < q->order.size() && (end == begin || batch_pts < min_batch_pts)) {
+				batch_pts += q->mpoly.rings[q->order[end]].pts.size();
+				end++;
+			}
+			q->next = end;
+		}
+		if(begin == end) break;
+		for(size_t i=begin; i<end; i++) {
+			size_t r_idx = q->order[i];
+			q->out[r_idx] = compute_reduced_ring(q->mpoly.rings[r_idx], q->tolerance);
+		}
+	}
+}
+
+Mpoly compute_reduced_pointset(const Mpoly &in_mpoly, double tolerance, int num_threads) {
 	if(VERBOSE) printf("reducing...\n");
 
 	if(!in_mpoly.rings.size()) {
@@ -57,9 +113,24 @@ Mpoly compute_reduced_pointset(const Mpoly &in_mpoly, double tolerance) {
 
 	std::vector<ReducedRing> reduced_rings(in_mpoly.rings.size());
 
-	for(size_t c_idx=0; c_idx<in_mpoly.rings.size(); c_idx++) {
-		reduced_rings[c_idx] = compute_reduced_ring(
-			in_mpoly.rings[c_idx], tolerance);
+	size_t num_workers = std::min(size_t(std::max(num_threads, 1)), in_mpoly.rings.size());
+	if(num_workers > 1) {
+		ReductionQueue q(in_mpoly, tolerance, reduced_rings);
+		q.order.resize(in_mpoly.rings.size());
+		for(size_t c_idx=0; c_idx<q.order.size(); c_idx++) q.order[c_idx] = c_idx;
+		std::sort(q.order.begin(), q.order.end(), RingIsBigger(in_mpoly));
+
+		boost::thread_group threads;
+		for(size_t i=1; i<num_workers; i++) {
+			threads.add_thread(new boost::thread(reduction_worker, &q));
+		}
+		reduction_worker(&q);
+		threads.join_all();
+	} else {
+		for(size_t c_idx=0; c_idx<in_mpoly.rings.size(); c_idx++) {
+			reduced_rings[c_idx] = compute_reduced_ring(
+				in_mpoly.rings[c_idx], tolerance);
+		}
 	}
 
 	fix_topology(in_mpoly, reduced_rings);
@@ -104,14 +175,156 @@ static inline double get_dist_to_seg(
 	}
 }
 
-ReducedRing compute_reduced_ring(const Ring &orig_string, double res) {
-//printf("enter dp\n");
+// Long segments are worth doing two points at a time.
+static const int MIN_SSE2_SPAN = 16;
+
+// Finds which of the points seg_begin+1 .. seg_end-1 is farthest from the
+// segment from point seg_begin to point seg_end.  Returns the distance (or -1
+// if there are no such points) and the index of the first point that far
+// away.  If the coordinates are also given in separate arrays (xs and ys),
+// with SSE2 two points are done at a time, the choice between the distance to
+// an endpoint or to the line being made with masks rather than branches.  The
+// arithmetic is the same either way, so the results are too.
+static double get_farthest_from_seg(
+	const std::vector<Vertex> &pts, const double *xs, const double *ys,
+	int seg_begin, int seg_end, int *idx_of_max
+) {
+	const double x1 = pts[seg_begin].x, y1 = pts[seg_begin].y;
+	const double x2 = pts[seg_end].x,   y2 = pts[seg_end].y;
+
+	double max_dist = -1.0;
+	*idx_of_max = -1;
+	int i = seg_begin+1;
+
+	double seg_vec_x = x2 - x1;
+	double seg_vec_y = y2 - y1;
+	double seg_vec_len = veclen(seg_vec_x, seg_vec_y);
+	if(seg_vec_len > 0.0) {
+		// normalize vector
+		seg_vec_x /= seg_vec_len;
+		seg_vec_y /= seg_vec_len;
+
+#ifdef __SSE2__
+		if(xs && seg_end - seg_begin >= MIN_SSE2_SPAN) {
+			const __m128d zero = _mm_setzero_pd();
+			const __m128d sign_bit = _mm_set1_pd(-0.0);
+			const __m128d epsilon = _mm_set1_pd(EPSILON);
+			const __m128d two = _mm_set1_pd(2.0);
+			const __m128d x1_v = _mm_set1_pd(x1), y1_v = _mm_set1_pd(y1);
+			const __m128d x2_v = _mm_set1_pd(x2), y2_v = _mm_set1_pd(y2);
+			const __m128d seg_vec_x_v = _mm_set1_pd(seg_vec_x);
+			const __m128d seg_vec_y_v = _mm_set1_pd(seg_vec_y);
+			__m128d bad_v = zero;
+			__m128d nan_v = zero;
+			__m128d max_v = _mm_set1_pd(-1.0);
+			__m128d max_idx_v = _mm_set1_pd(-1.0);
+			__m128d idx_v = _mm_set_pd(i+1, i);
+			for(; i+1<seg_end; i+=2) {
+				__m128d x = _mm_loadu_pd(xs+i);
+				__m128d y = _mm_loadu_pd(ys+i);
+				__m128d vx1 = _mm_sub_pd(x, x1_v);
+				__m128d vy1 = _mm_sub_pd(y, y1_v);
+				__m128d scalar_prod1 = _mm_add_pd(
+					_mm_mul_pd(vx1, seg_vec_x_v), _mm_mul_pd(vy1, seg_vec_y_v));
+				__m128d vx2 = _mm_sub_pd(x2_v, x);
+				__m128d vy2 = _mm_sub_pd(y2_v, y);
+				__m128d scalar_prod2 = _mm_add_pd(
+					_mm_mul_pd(vx2, seg_vec_x_v), _mm_mul_pd(vy2, seg_vec_y_v));
+
+				__m128d dist1_sq = _mm_add_pd(_mm_mul_pd(vx1, vx1), _mm_mul_pd(vy1, vy1));
+				__m128d c_squared = _mm_add_pd(_mm_mul_pd(vx2, vx2), _mm_mul_pd(vy2, vy2));
+				__m128d a_squared = _mm_mul_pd(scalar_prod2, scalar_prod2);
+				__m128d b_squared = _mm_sub_pd(c_squared, a_squared);
+
+				__m128d past_begin = _mm_cmplt_pd(scalar_prod1, zero);
+				__m128d past_end = _mm_cmplt_pd(scalar_prod2, zero);
+				__m128d negative = _mm_cmplt_pd(b_squared, zero);
+				__m128d roundoff = _mm_cmplt_pd(
+					_mm_andnot_pd(sign_bit, b_squared), _mm_mul_pd(a_squared, epsilon));
+				bad_v = _mm_or_pd(bad_v, _mm_andnot_pd(_mm_or_pd(past_begin, past_end),
+					_mm_andnot_pd(roundoff, negative)));
+				b_squared = _mm_andnot_pd(negative, b_squared);
+
+				__m128d dist_sq = _mm_or_pd(_mm_and_pd(past_end, c_squared),
+					_mm_andnot_pd(past_end, b_squared));
+				dist_sq = _mm_or_pd(_mm_and_pd(past_begin, dist1_sq),
+					_mm_andnot_pd(past_begin, dist_sq));
+				__m128d dist = _mm_sqrt_pd(dist_sq);
+
+				__m128d greater = _mm_cmpgt_pd(dist, max_v);
+				max_v = _mm_or_pd(_mm_and_pd(greater, dist), _mm_andnot_pd(greater, max_v));
+				max_idx_v = _mm_or_pd(_mm_and_pd(greater, idx_v), _mm_andnot_pd(greater, max_idx_v));
+				nan_v = _mm_or_pd(nan_v, _mm_cmpunord_pd(dist, dist));
+				idx_v = _mm_add_pd(idx_v, two);
+			}
+			if(_mm_movemask_pd(bad_v)) fatal_error("a_squared > c_squared");
+			if(_mm_movemask_pd(nan_v)) fatal_error("dist_to_seg == NaN");
+
+			// Each half has the first of its own farthest points.  Take the
+			// farther, or the earlier if they are the same.
+			double lane_max[2], lane_idx[2];
+			_mm_storeu_pd(lane_max, max_v);
+			_mm_storeu_pd(lane_idx, max_idx_v);
+			for(int lane=0; lane<2; lane++) {
+				if(lane_max[lane] > max_dist || (lane_max[lane] == max_dist &&
+					lane_max[lane] >= 0 && int(lane_idx[lane]) < *idx_of_max)
+				) {
+					max_dist = lane_max[lane];
+					*idx_of_max = int(lane_idx[lane]);
+				}
+			}
+		}
+#else
+		(void)xs; (void)ys;
+#endif
+		// the rest, one at a time
+		for(; i<seg_end; i++) {
+			double dist_to_seg = get_dist_to_seg(seg_vec_x, seg_vec_y,
+				pts[seg_begin], pts[seg_end], pts[i]);
+			if(dist_to_seg < 0.0) fatal_error("dist_to_seg < 0.0");
+			if(std::isnan(dist_to_seg)) fatal_error("dist_to_seg == NaN");
+
+			if(dist_to_seg > max_dist) {
+				max_dist = dist_to_seg;
+				*idx_of_max = i;
+			}
+		}
+	} else {
+		// Segment is length zero, so we can't use get_dist_to_seg.
+		// Instead, just use cartesian distance
+		for(; i<seg_end; i++) {
+			double dx = pts[i].x - x1;
+			double dy = pts[i].y - y1;
+			double dist_to_seg = veclen(dx, dy);
+
+			if(dist_to_seg > max_dist) {
+				max_dist = dist_to_seg;
+				*idx_of_max = i;
+			}
+		}
+	}
 
+	return max_dist;
+}
+
+ReducedRing compute_reduced_ring(const Ring &orig_string, double res) {
 	const std::vector<Vertex> &pts_in = orig_string.pts;
 	const size_t num_in = pts_in.size();
 
 	double tolerance = res;
-	int i;
+
+	// Only long rings have segments long enough to bother with SSE2.
+	std::vector<double> xs, ys;
+#ifdef __SSE2__
+	if(num_in >= size_t(4 * MIN_SSE2_SPAN)) {
+		xs.resize(num_in);
+		ys.resize(num_in);
+		for(size_t i=0; i<num_in; i++) {
+			xs[i] = pts_in[i].x;
+			ys[i] = pts_in[i].y;
+		}
+	}
+#endif
 
 	std::vector<segment_t> stack(num_in);
 	size_t stack_ptr = 0;
@@ -129,45 +342,12 @@ ReducedRing compute_reduced_ring(const Ring &orig_string, double res) {
 		stack_ptr--;
 		int seg_begin = stack[stack_ptr].begin;
 		int seg_end = stack[stack_ptr].end;
-//printf("stack_ptr=%d / range=[%d,%d]\n", stack_ptr, seg_begin, seg_end);
-
-		double max_dist = -1.0;
-		int idx_of_max = -1; // to prevent compiler warning
-
-		double seg_vec_x = pts_in[seg_end].x - pts_in[seg_begin].x;
-		double seg_vec_y = pts_in[seg_end].y - pts_in[seg_begin].y;
-		double seg_vec_len = veclen(seg_vec_x, seg_vec_y);
-		if(seg_vec_len > 0.0) {
-			// normalize vector
-			seg_vec_x /= seg_vec_len;
-			seg_vec_y /= seg_vec_len;
-			for(i=seg_begin+1; i<seg_end; i++) {
-				double dist_to_seg = get_dist_to_seg(seg_vec_x, seg_vec_y,
-					pts_in[seg_begin], pts_in[seg_end], pts_in[i]);
-				if(dist_to_seg < 0.0) fatal_error("dist_to_seg < 0.0");
-				if(std::isnan(dist_to_seg)) fatal_error("dist_to_seg == NaN");
-
-				if(dist_to_seg > max_dist) {
-					max_dist = dist_to_seg;
-					idx_of_max = i;
-				}
-			}
-		} else {
-			// Segment is length zero, so we can't use get_dist_to_seg.
-			// Instead, just use cartesian distance
-			for(i=seg_begin+1; i<seg_end; i++) {
-				double dx = pts_in[i].x - pts_in[seg_begin].x;
-				double dy = pts_in[i].y - pts_in[seg_begin].y;
-				double dist_to_seg = veclen(dx, dy);
-
-				if(dist_to_seg > max_dist) {
-					max_dist = dist_to_seg;
-					idx_of_max = i;
-				}
-			}
-		}
 
-//printf("max=%.15f, toler=%.15f, idx=%i\n", max_dist, tolerance, idx_of_max);
+		int idx_of_max;
+		double max_dist = get_farthest_from_seg(pts_in,
+			xs.empty() ? NULL : &xs[0], ys.empty() ? NULL : &ys[0],
+			seg_begin, seg_end, &idx_of_max);
+
 		if(max_dist >= tolerance) {
 			if(idx_of_max <= 0) fatal_error(
 				"idx_of_max out of range (perhaps it wasn't set?)");
@@ -190,9 +370,6 @@ ReducedRing compute_reduced_ring(const Ring &orig_string, double res) {
 		}
 	}
 
-//printf("keeping %d of %d\n", keep.segs.size(), num_in);
-//printf("exit dp\n");
-
 	return keep;
 }
 
@@ -335,29 +512,166 @@ static inline int segs_cross(
 		1);
 }
 
-// This allows rapidly finding which segments intersect each other.
-// The std::pair consists of the ring and segment indices.
-BboxBinarySpacePartition<std::pair<size_t, size_t> > get_bsp_for_reduced_rings(
-	const Mpoly &mpoly, std::vector<ReducedRing> &reduced_rings
-) {
-	typedef std::pair<size_t, size_t> segptr_t;
-	std::vector<std::pair<Bbox, segptr_t> > items;
-
-	for(size_t ring_idx=0; ring_idx < mpoly.rings.size(); ring_idx++) {
-		const Ring &ring = mpoly.rings[ring_idx];
-		const ReducedRing &reduced = reduced_rings[ring_idx];
-		for(size_t seg_idx=0; seg_idx < reduced.segs.size(); seg_idx++) {
-			Bbox bbox = reduced.segs[seg_idx].get_bbox(ring);
-			items.push_back(std::make_pair(bbox, segptr_t(ring_idx, seg_idx)));
+typedef std::pair<size_t, size_t> segptr_t;
+
+// A segment that was changed in the given pass of fix_topology.
+struct ChangedSeg {
+	ChangedSeg(const segptr_t &_seg, int _pass) : seg(_seg), pass(_pass) { }
+
+	segptr_t seg;
+	int pass;
+};
+
+// This allows rapidly finding which segments intersect each other.  Each
+// segment is referred to by its ring and segment indices.
+//
+// The segments as they were when the index was made stay in one tree.  Those
+// that are split or added later go into smaller trees, one per update(), and
+// these are merged whenever one gets to be as big as the one before it, so
+// that there are never very many of them.  A segment that changes again is
+// left in its old tree, but since the pass it last changed in is kept, stale
+// entries are easy to tell apart, and are dropped at the next merge.  This way
+// the work done to keep the index up to date goes with the number of
+// segments that change, rather than the number there are in all.  It also
+// makes it cheap to find only those segments that changed after a given pass.
+class ReducedRingIndex {
+public:
+	ReducedRingIndex(const Mpoly &_mpoly, const std::vector<ReducedRing> &_reduced_rings) :
+		mpoly(_mpoly), reduced_rings(_reduced_rings)
+	{
+		std::vector<std::pair<Bbox, segptr_t> > items;
+		changed_in_pass.resize(mpoly.rings.size());
+		for(size_t ring_idx=0; ring_idx < mpoly.rings.size(); ring_idx++) {
+			const ReducedRing &reduced = reduced_rings[ring_idx];
+			changed_in_pass[ring_idx].resize(reduced.segs.size(), 0);
+			for(size_t seg_idx=0; seg_idx < reduced.segs.size(); seg_idx++) {
+				segptr_t seg(ring_idx, seg_idx);
+				items.push_back(std::make_pair(get_bbox(seg), seg));
+			}
 		}
+		orig_segs.reset(new BboxRTree<segptr_t>(items));
 	}
 
-	return BboxBinarySpacePartition<segptr_t>(items);
-}
+	// Must be called whenever a segment is split or added.  Passes are
+	// numbered from 1.
+	void segment_changed(const segptr_t &seg, int pass) {
+		std::vector<int> &changed = changed_in_pass[seg.first];
+		if(seg.second >= changed.size()) changed.resize(seg.second+1, 0);
+		if(changed[seg.second] == pass) return;
+		changed[seg.second] = pass;
+		pending.push_back(ChangedSeg(seg, pass));
+	}
+
+	// The last pass the segment changed in, or 0 if it never has.
+	int get_changed_pass(const segptr_t &seg) const {
+		return changed_in_pass[seg.first][seg.second];
+	}
+
+	// Brings the index up to date with the changed segments.
+	void update() {
+		if(pending.empty()) return;
+		levels.push_back(Level());
+		levels.back().items.swap(pending);
+		while(levels.size() > 1 &&
+			levels[levels.size()-2].items.size() <= 2*levels.back().items.size()
+		) {
+			Level &prev = levels[levels.size()-2];
+			BOOST_FOREACH(const ChangedSeg &cs, levels.back().items) {
+				prev.items.push_back(cs);
+			}
+			levels.pop_back();
+		}
+		build(levels.back());
+	}
+
+	// Adds the segments that intersect bbox.
+	void append_intersecting_items(std::vector<segptr_t> &out, const Bbox &bbox) const {
+		OrigSegCollector orig_collector(*this, out);
+		orig_segs->visit_intersecting_items(bbox, orig_collector);
+		append_changed_items(out, bbox, 0);
+	}
+
+	// Adds the segments that changed after the given pass and intersect bbox.
+	void append_changed_items(std::vector<segptr_t> &out, const Bbox &bbox, int after_pass) const {
+		ChangedSegCollector changed_collector(*this, out, after_pass);
+		BOOST_FOREACH(const Level &level, levels) {
+			if(level.max_pass <= after_pass) continue;
+			level.tree->visit_intersecting_items(bbox, changed_collector);
+		}
+	}
+
+private:
+	struct Level {
+		std::vector<ChangedSeg> items;
+		int max_pass;
+		boost::shared_ptr<BboxRTree<ChangedSeg> > tree;
+	};
+
+	// visitor for orig_segs, skips those that have since changed
+	struct OrigSegCollector {
+		OrigSegCollector(const ReducedRingIndex &_index, std::vector<segptr_t> &_out) :
+			index(_index), out(_out) { }
+		void operator()(const segptr_t &seg) {
+			if(!index.get_changed_pass(seg)) out.push_back(seg);
+		}
+		const ReducedRingIndex &index;
+		std::vector<segptr_t> &out;
+	};
+
+	// visitor for the trees of changed segments, skips stale entries
+	struct ChangedSegCollector {
+		ChangedSegCollector(const ReducedRingIndex &_index, std::vector<segptr_t> &_out, int _after_pass) :
+			index(_index), out(_out), after_pass(_after_pass) { }
+		void operator()(const ChangedSeg &cs) {
+			if(cs.pass > after_pass && cs.pass == index.get_changed_pass(cs.seg)) {
+				out.push_back(cs.seg);
+			}
+		}
+		const ReducedRingIndex &index;
+		std::vector<segptr_t> &out;
+		int after_pass;
+	};
+
+	Bbox get_bbox(const segptr_t &seg) const {
+		return reduced_rings[seg.first].segs[seg.second].get_bbox(mpoly.rings[seg.first]);
+	}
+
+	// drops the stale entries from a level and makes its tree
+	void build(Level &level) {
+		std::vector<ChangedSeg> live;
+		std::vector<std::pair<Bbox, ChangedSeg> > tree_items;
+		level.max_pass = 0;
+		BOOST_FOREACH(const ChangedSeg &cs, level.items) {
+			if(cs.pass != get_changed_pass(cs.seg)) continue;
+			live.push_back(cs);
+			tree_items.push_back(std::make_pair(get_bbox(cs.seg), cs));
+			level.max_pass = std::max(level.max_pass, cs.pass);
+		}
+		level.items.swap(live);
+		level.tree.reset(new BboxRTree<ChangedSeg>(tree_items));
+	}
+
+	const Mpoly &mpoly;
+	const std::vector<ReducedRing> &reduced_rings;
+	boost::shared_ptr<BboxRTree<segptr_t> > orig_segs;
+	std::vector<std::vector<int> > changed_in_pass;
+	std::vector<ChangedSeg> pending;
+	std::vector<Level> levels;
+};
+
+// The segments found to cross a segment when it was last checked against all
+// of the others (in the given pass, with 0 being the first check of every
+// segment against every other).
+struct KnownCrossings {
+	KnownCrossings() : pass(0) { }
+
+	int pass;
+	std::vector<segptr_t> segs;
+};
 
 void fix_topology(const Mpoly &mpoly, std::vector<ReducedRing> &reduced_rings) {
 	const double firsthalf_progress = 0.5;
-	printf("Fixing topology: ");
+	status_printf("Fixing topology: ");
 	fflush(stdout);
 
 	assert(mpoly.rings.size() == reduced_rings.size());
@@ -368,24 +682,39 @@ void fix_topology(const Mpoly &mpoly, std::vector<ReducedRing> &reduced_rings) {
 		const ReducedRing &rring = reduced_rings[r1_idx];
 		mp_problems[r1_idx].resize(rring.segs.size(), 0);
 	}
+	// set for rings that have any problem segments, so the others can be
+	// skipped over
+	std::vector<bool> ring_has_problems(mpoly.rings.size(), 0);
+
+	ReducedRingIndex index(mpoly, reduced_rings);
+
+	// Problem segments that don't change usually stay problems for many
+	// passes (for instance where rings touch at a corner).  Rather than
+	// searching the whole index for these each time, only the segments that
+	// have changed since are looked at, along with the ones that crossed last
+	// time.
+	std::vector<std::vector<KnownCrossings> > known_crossings(mpoly.rings.size());
+	for(size_t r1_idx=0; r1_idx < mpoly.rings.size(); r1_idx++) {
+		known_crossings[r1_idx].resize(reduced_rings[r1_idx].segs.size());
+	}
+
+	// reused for every query, to save allocating a new one each time
+	std::vector<segptr_t> intersecting_segments;
 
 	int num_problems = 0;
 	{
-		const BboxBinarySpacePartition<std::pair<size_t, size_t> > bsp =
-			get_bsp_for_reduced_rings(mpoly, reduced_rings);
-
 		// flag segments that cross
 		for(size_t r1_idx=0; r1_idx < mpoly.rings.size(); r1_idx++) {
-			GDALTermProgress(firsthalf_progress*
-				pow((double)r1_idx / (double)mpoly.rings.size(), 2), NULL, NULL);
+			term_progress(firsthalf_progress*
+				pow((double)r1_idx / (double)mpoly.rings.size(), 2));
 			const Ring &c1 = mpoly.rings[r1_idx];
 			const ReducedRing &r1 = reduced_rings[r1_idx];
 			std::vector<bool> &p1 = mp_problems[r1_idx];
 
 			for(size_t seg1_idx=0; seg1_idx < r1.segs.size(); seg1_idx++) {
 				Bbox seg1_bbox = r1.segs[seg1_idx].get_bbox(c1);
-				std::vector<std::pair<size_t, size_t> > intersecting_segments =
-					bsp.get_intersecting_items(seg1_bbox);
+				intersecting_segments.clear();
+				index.append_intersecting_items(intersecting_segments, seg1_bbox);
 				for(size_t i_s_idx=0; i_s_idx < intersecting_segments.size(); i_s_idx++) {
 					size_t r2_idx = intersecting_segments[i_s_idx].first;
 					size_t seg2_idx = intersecting_segments[i_s_idx].second;
@@ -405,7 +734,12 @@ void fix_topology(const Mpoly &mpoly, std::vector<ReducedRing> &reduced_rings) {
 						//	r1_idx, seg1_idx, r2_idx, seg2_idx);
 						p1[seg1_idx] = 1;
 						p2[seg2_idx] = 1;
+						ring_has_problems[r1_idx] = 1;
+						ring_has_problems[r2_idx] = 1;
 						num_problems += 2;
+						// every segment is being checked against every other
+						known_crossings[r1_idx][seg1_idx].segs.push_back(segptr_t(r2_idx, seg2_idx));
+						known_crossings[r2_idx][seg2_idx].segs.push_back(segptr_t(r1_idx, seg1_idx));
 					}
 				} // ring2/seg2 loop
 			} // seg1 loop
@@ -413,18 +747,21 @@ void fix_topology(const Mpoly &mpoly, std::vector<ReducedRing> &reduced_rings) {
 	}
 
 	double progress = firsthalf_progress;
-	GDALTermProgress(progress, NULL, NULL);
+	term_progress(progress);
 
 	if(num_problems) {
 		if(VERBOSE) printf("fixing %d crossed segments from reduction\n", num_problems/2);
 	}
 
 	int did_something = 1;
+	int pass = 0;
 	while(num_problems && did_something) {
 		//printf("%d crossings to fix\n", num_problems/2);
 		did_something = 0;
+		pass++;
 		// subdivide problem segments
 		for(size_t r1_idx=0; r1_idx < mpoly.rings.size(); r1_idx++) {
+			if(!ring_has_problems[r1_idx]) continue;
 			ReducedRing &r1 = reduced_rings[r1_idx];
 			std::vector<bool> &p1 = mp_problems[r1_idx];
 			size_t orig_num_segs = r1.segs.size(); // this number will change as we go, so copy it
@@ -440,21 +777,26 @@ void fix_topology(const Mpoly &mpoly, std::vector<ReducedRing> &reduced_rings) {
 				r1.segs[seg1_idx].end = mid;
 				r1.segs.push_back(segment_t(mid, end));
 				p1.push_back(1);
+				known_crossings[r1_idx].push_back(KnownCrossings());
+				index.segment_changed(segptr_t(r1_idx, seg1_idx), pass);
+				index.segment_changed(segptr_t(r1_idx, r1.segs.size()-1), pass);
 				did_something = 1;
 			} // seg loop
 		} // ring loop
 
-		const BboxBinarySpacePartition<std::pair<size_t, size_t> > bsp =
-			get_bsp_for_reduced_rings(mpoly, reduced_rings);
+		index.update();
 
 		num_problems = 0;
 		// now test for resolved problems and new problems
 		for(size_t r1_idx=0; r1_idx < mpoly.rings.size(); r1_idx++) {
+			if(!ring_has_problems[r1_idx]) continue;
 			{
 				double alpha = double(r1_idx) / mpoly.rings.size();
 				double p = progress + (1.0-progress)/2*alpha;
-				GDALTermProgress(p, NULL, NULL);
+				term_progress(p);
 			}
+			// will be set again if any problems remain
+			ring_has_problems[r1_idx] = 0;
 
 			const Ring &c1 = mpoly.rings[r1_idx];
 			const ReducedRing &r1 = reduced_rings[r1_idx];
@@ -463,9 +805,24 @@ void fix_topology(const Mpoly &mpoly, std::vector<ReducedRing> &reduced_rings) {
 				if(!p1[seg1_idx]) continue;
 				p1[seg1_idx] = 0;
 
+				segptr_t seg1(r1_idx, seg1_idx);
 				Bbox seg1_bbox = r1.segs[seg1_idx].get_bbox(c1);
-				std::vector<std::pair<size_t, size_t> > intersecting_segments =
-					bsp.get_intersecting_items(seg1_bbox);
+				intersecting_segments.clear();
+				KnownCrossings &known = known_crossings[r1_idx][seg1_idx];
+				if(index.get_changed_pass(seg1) <= known.pass) {
+					int known_pass = known.pass;
+					BOOST_FOREACH(const segptr_t &seg2, known.segs) {
+						if(index.get_changed_pass(seg2) <= known_pass) {
+							intersecting_segments.push_back(seg2);
+						}
+					}
+					index.append_changed_items(intersecting_segments, seg1_bbox, known_pass);
+				} else {
+					index.append_intersecting_items(intersecting_segments, seg1_bbox);
+				}
+
+				known.pass = pass;
+				known.segs.clear();
 				for(size_t i_s_idx=0; i_s_idx < intersecting_segments.size(); i_s_idx++) {
 					size_t r2_idx = intersecting_segments[i_s_idx].first;
 					size_t seg2_idx = intersecting_segments[i_s_idx].second;
@@ -491,7 +848,10 @@ void fix_topology(const Mpoly &mpoly, std::vector<ReducedRing> &reduced_rings) {
 						p1[seg1_idx] = 1;
 						std::vector<bool> &p2 = mp_problems[r2_idx];
 						p2[seg2_idx] = 1;
+						ring_has_problems[r1_idx] = 1;
+						ring_has_problems[r2_idx] = 1;
 						num_problems++;
+						known.segs.push_back(intersecting_segments[i_s_idx]);
 					}
 				} // ring2/seg2 loop
 			} // seg1 loop
@@ -500,7 +860,7 @@ void fix_topology(const Mpoly &mpoly, std::vector<ReducedRing> &reduced_rings) {
 		progress += (1.0-progress)/2;
 	} // while problems
 
-	GDALTermProgress(1, NULL, NULL);
+	term_progress(1);
 
 	if(num_problems) {
 		printf("WARNING: Could not fix all topology problems.\n  Please inspect output shapefile manually.\n");
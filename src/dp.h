@@ -54,7 +54,9 @@ struct ReducedRing {
 	std::vector<segment_t> segs;
 };
 
-Mpoly compute_reduced_pointset(const Mpoly &in_mpoly, double tolerance);
+// With num_threads > 1, the rings are reduced in that many threads.  The
+// output is the same either way.
+Mpoly compute_reduced_pointset(const Mpoly &in_mpoly, double tolerance, int num_threads=1);
 ReducedRing compute_reduced_ring(const Ring &orig_string, double res);
 void fix_topology(const Mpoly &mpoly, std::vector<ReducedRing> &reduced_rings);
 Mpoly reduction_to_mpoly(const Mpoly &in_mpoly, const std::vector<ReducedRing> &reduced_rings);
@@ -100,6 +100,60 @@ bool picky_transform(
 	return 1;
 }
 
+// Same as calling picky_transform on each of the given points, but with one
+// call to OCTTransform in each direction for a whole batch of points.
+// Afterwards ok[i] tells whether pts[i] was transformed.
+void picky_transform(
+	OGRCoordinateTransformationH fwd_xform,
+	OGRCoordinateTransformationH inv_xform,
+	std::vector<Vertex> &pts,
+	std::vector<bool> &ok
+) {
+	// tolerance in meters, could probably be much smaller
+	const double toler = 1.0;
+
+	ok.assign(pts.size(), false);
+
+	// OCTTransformEx takes an int count
+	const size_t max_batch = 1 << 20;
+	for(size_t begin=0; begin<pts.size(); begin+=max_batch) {
+		size_t n = std::min(pts.size() - begin, max_batch);
+		std::vector<double> out_x(n), out_y(n);
+		for(size_t i=0; i<n; i++) {
+			out_x[i] = pts[begin+i].x;
+			out_y[i] = pts[begin+i].y;
+		}
+		std::vector<double> back_x, back_y;
+		std::vector<int> fwd_ok(n), inv_ok(n);
+
+		bool batch_ok =
+			OCTTransformEx(fwd_xform, int(n), &out_x[0], &out_y[0], NULL, &fwd_ok[0]);
+		if(batch_ok) {
+			back_x = out_x;
+			back_y = out_y;
+			batch_ok =
+				OCTTransformEx(inv_xform, int(n), &back_x[0], &back_y[0], NULL, &inv_ok[0]);
+		}
+		if(!batch_ok) {
+			// Some versions of GDAL fail the whole call if any point fails,
+			// so fall back to one point at a time.
+			for(size_t i=0; i<n; i++) {
+				ok[begin+i] = picky_transform(fwd_xform, inv_xform, &pts[begin+i]);
+			}
+			continue;
+		}
+
+		for(size_t i=0; i<n; i++) {
+			if(!fwd_ok[i] || !inv_ok[i]) continue;
+			Vertex &v_in = pts[begin+i];
+			double err = hypot(v_in.x - back_x[i], v_in.y - back_y[i]);
+			if(err > toler) continue;
+			v_in = Vertex(out_x[i], out_y[i]);
+			ok[begin+i] = true;
+		}
+	}
+}
+
 int main(int argc, char **argv) {
 	const std::string cmdname = argv[0];
 	if(argc == 1) usage(cmdname);
@@ -188,6 +242,7 @@ int main(int argc, char **argv) {
 	// source region (such as would be the case for a source region that
 	// encircles the pole with a target lonlat projection).
 	int num_grid_steps = 100;
+	std::vector<Vertex> interior_pts;
 	for(int grid_xi=0; grid_xi<=num_grid_steps; grid_xi++) {
 		Vertex src_pt;
 		double alpha_x = (double)grid_xi / (double)num_grid_steps;
@@ -198,18 +253,21 @@ int main(int argc, char **argv) {
 			if(!src_mp.contains(src_pt)) continue;
 
 			ps_interior.total++;
+			interior_pts.push_back(src_pt);
+		}
+	}
 
-			Vertex tgt_pt = src_pt;
-			if(!picky_transform(fwd_xform, inv_xform, &tgt_pt)) {
-				continue;
-			}
+	std::vector<bool> proj_ok;
+	picky_transform(fwd_xform, inv_xform, interior_pts, proj_ok);
+	for(size_t i=0; i<interior_pts.size(); i++) {
+		if(!proj_ok[i]) continue;
 
-			ps_interior.proj_ok++;
+		ps_interior.proj_ok++;
 
-			if(!use_t_bounds || t_bounds_mp.contains(tgt_pt)) {
-				ps_interior.contained++;
-				pl.pts.push_back(tgt_pt);
-			}
+		const Vertex &tgt_pt = interior_pts[i];
+		if(!use_t_bounds || t_bounds_mp.contains(tgt_pt)) {
+			ps_interior.contained++;
+			pl.pts.push_back(tgt_pt);
 		}
 	}
 
@@ -217,6 +275,7 @@ int main(int argc, char **argv) {
 	double max_step_len = std::max(
 		src_bbox.max_x - src_bbox.min_x,
 		src_bbox.max_y - src_bbox.min_y) / 1000.0;
+	std::vector<Vertex> border_pts;
 	for(size_t r_idx=0; r_idx<src_mp.rings.size(); r_idx++) {
 		const Ring &ring = src_mp.rings[r_idx];
 		for(size_t v_idx=0; v_idx<ring.pts.size(); v_idx++) {
@@ -233,19 +292,21 @@ int main(int argc, char **argv) {
 				src_pt.y = v1.y + dy * alpha;
 
 				ps_border.total++;
+				border_pts.push_back(src_pt);
+			}
+		}
+	}
 
-				Vertex tgt_pt = src_pt;
-				if(!picky_transform(fwd_xform, inv_xform, &tgt_pt)) {
-					continue;
-				}
+	picky_transform(fwd_xform, inv_xform, border_pts, proj_ok);
+	for(size_t i=0; i<border_pts.size(); i++) {
+		if(!proj_ok[i]) continue;
 
-				ps_border.proj_ok++;
+		ps_border.proj_ok++;
 
-				if(!use_t_bounds || t_bounds_mp.contains(tgt_pt)) {
-					ps_border.contained++;
-					pl.pts.push_back(tgt_pt);
-				}
-			}
+		const Vertex &tgt_pt = border_pts[i];
+		if(!use_t_bounds || t_bounds_mp.contains(tgt_pt)) {
+			ps_border.contained++;
+			pl.pts.push_back(tgt_pt);
 		}
 	}
 
@@ -255,6 +316,7 @@ int main(int argc, char **argv) {
 		double max_step_len = std::max(
 			t_bounds_bbox.max_x - t_bounds_bbox.min_x,
 			t_bounds_bbox.max_y - t_bounds_bbox.min_y) / 1000.0;
+		std::vector<Vertex> bounds_pts;
 		for(size_t r_idx=0; r_idx<t_bounds_mp.rings.size(); r_idx++) {
 			const Ring &ring = t_bounds_mp.rings[r_idx];
 			for(size_t v_idx=0; v_idx<ring.pts.size(); v_idx++) {
@@ -271,19 +333,21 @@ int main(int argc, char **argv) {
 					tgt_pt.y = v1.y + dy * alpha;
 
 					ps_bounds.total++;
+					bounds_pts.push_back(tgt_pt);
+				}
+			}
+		}
 
-					Vertex src_pt = tgt_pt;
-					if(!picky_transform(inv_xform, fwd_xform, &src_pt)) {
-						continue;
-					}
+		std::vector<Vertex> src_pts = bounds_pts;
+		picky_transform(inv_xform, fwd_xform, src_pts, proj_ok);
+		for(size_t i=0; i<bounds_pts.size(); i++) {
+			if(!proj_ok[i]) continue;
 
-					ps_bounds.proj_ok++;
+			ps_bounds.proj_ok++;
 
-					if(src_mp.contains(src_pt)) {
-						ps_bounds.contained++;
-						pl.pts.push_back(tgt_pt);
-					}
-				}
+			if(src_mp.contains(src_pts[i])) {
+				ps_bounds.contained++;
+				pl.pts.push_back(bounds_pts[i]);
 			}
 		}
 	}
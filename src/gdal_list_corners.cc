@@ -60,6 +60,8 @@ void usage(const std::string &cmdname) {
 "  -mask-out fn.pbm            Output mask of bounding polygon in PBM format\n"
 "\n"
 "Misc:\n"
+"  -threads N                  Number of threads to use for reading the input\n"
+"                              (default is 1)\n"
 "  -v                          Verbose\n"
 "\n"
 "Examples:\n"
@@ -85,6 +87,7 @@ int main(int argc, char **argv) {
 	std::string mask_out_fn;
 	std::vector<size_t> inspect_bandids;
 	bool do_erosion = 0;
+	int num_threads = 1;
 
 	// We will be sending YAML to stdout, so stuff that would normally
 	// go to stdout (such as debug messages or progress bars) should
@@ -118,6 +121,10 @@ int main(int argc, char **argv) {
 				} else if(arg == "-report") {
 					if(argp == arg_list.size()) usage(cmdname);
 					debug_report = arg_list[argp++];
+				} else if(arg == "-threads") {
+					if(argp == arg_list.size()) usage(cmdname);
+					num_threads = boost::lexical_cast<int>(arg_list[argp++]);
+					if(num_threads < 1) fatal_error("-threads must be at least 1");
 				} else if(arg == "-mask-out") {
 					if(argp == arg_list.size()) usage(cmdname);
 					mask_out_fn = arg_list[argp++];
@@ -174,7 +181,7 @@ int main(int argc, char **argv) {
 			dbuf = new DebugPlot(georef.w, georef.h, PLOT_RECT4);
 		}
 
-		mask = get_bitgrid_for_dataset(ds, inspect_bandids, ndv_def, dbuf);
+		mask = get_bitgrid_for_dataset(ds, inspect_bandids, ndv_def, dbuf, num_threads);
 
 		if(do_erosion) {
 			mask.erode();
@@ -31,6 +31,7 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 #include "common.h"
 #include "ndv.h"
 #include "mask.h"
+#include "tiled-store.h"
 
 using namespace dangdal;
 
@@ -46,6 +47,9 @@ void usage(const std::string &cmdname) {
 "  -b band_id -b band_id ...   Bands to inspect (default is all bands)\n"
 "  -invert              Make mask cover no-data pixels instead of data pixels\n"
 "  -erosion             Erode pixels that don't have two consecutive neighbors\n"
+"  -threads N           Number of threads to use for reading the input\n"
+"  -mem-limit MB        Keep the mask in a temporary file if it is bigger than\n"
+"                       this, caching at most this much in memory\n"
 "  -v                   Verbose\n"
 "\n"
 	);
@@ -62,6 +66,7 @@ int main(int argc, char **argv) {
 	bool do_erosion = 0;
 	bool do_invert = 0;
 	std::vector<size_t> inspect_bandids;
+	int num_threads = 1;
 
 	NdvDef ndv_def = NdvDef(arg_list);
 
@@ -81,6 +86,13 @@ int main(int argc, char **argv) {
 					do_erosion = 1;
 				} else if(arg == "-invert") {
 					do_invert = 1;
+				} else if(arg == "-threads") {
+					if(argp == arg_list.size()) usage(cmdname);
+					num_threads = boost::lexical_cast<int>(arg_list[argp++]);
+					if(num_threads < 1) fatal_error("-threads must be at least 1");
+				} else if(arg == "-mem-limit") {
+					if(argp == arg_list.size()) usage(cmdname);
+					GRID_MEMORY_LIMIT = size_t(boost::lexical_cast<double>(arg_list[argp++]) * (1 << 20));
 				} else if(arg == "-mask-out") {
 					if(argp == arg_list.size()) usage(cmdname);
 					mask_out_fn = arg_list[argp++];
@@ -121,11 +133,18 @@ int main(int argc, char **argv) {
 		ndv_def = NdvDef(ds, inspect_bandids);
 	}
 
-	if(ndv_def.empty()) {
+	// With no NDV, the mask still shows where the NaN pixels are.
+	bool can_be_nan = false;
+	BOOST_FOREACH(const size_t band_id, inspect_bandids) {
+		GDALRasterBandH band = GDALGetRasterBand(ds, band_id);
+		if(!band) fatal_error("Could not open band %zd.", band_id);
+		if(datatype_can_be_nan(GDALGetRasterDataType(band))) can_be_nan = true;
+	}
+	if(ndv_def.empty() && !can_be_nan) {
 		fatal_error("cannot determine no-data-value");
 	}
 
-	BitGrid mask = get_bitgrid_for_dataset(ds, inspect_bandids, ndv_def, NULL);
+	BitGrid mask = get_bitgrid_for_dataset(ds, inspect_bandids, ndv_def, NULL, num_threads);
 
 	GDALClose(ds);
 
@@ -26,11 +26,13 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 
 
 
+#include <algorithm>
 #include <map>
 #include <vector>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 
 #include "common.h"
 #include "polygon.h"
@@ -40,6 +42,7 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 #include "ndv.h"
 #include "mask.h"
 #include "mask-tracer.h"
+#include "tiled-store.h"
 #include "dp.h"
 #include "excursion_pincher.h"
 #include "beveler.h"
@@ -101,6 +104,11 @@ void usage(const std::string &cmdname) {
 "  -pinch-excursions            Remove all the complicated 'mouse bites' that\n"
 "                               occur in the outline when lossy compression\n"
 "                               has been used (experimental)\n"
+"  -coarse-to-fine              Only read the blocks of the input near the edges\n"
+"                               seen in its overviews (has no effect if it has\n"
+"                               none).  Much faster for big rasters, but features\n"
+"                               much smaller than a block can be missed.  Not\n"
+"                               used with -classify.\n"
 "\n"
 "Output:\n"
 "  -report fn.ppm               Output graphical report of polygons found\n"
@@ -119,6 +127,13 @@ void usage(const std::string &cmdname) {
 "                               multipolygon\n"
 "\n"
 "Misc:\n"
+"  -threads N                   Number of threads to use for reading the input,\n"
+"                               beveling, reducing rings and, with -classify,\n"
+"                               for processing features\n"
+"                               (default is 1)\n"
+"  -mem-limit MB                Keep masks bigger than this in a temporary\n"
+"                               file, caching at most this much of each\n"
+"                               in memory (default is no limit)\n"
 "  -v                           Verbose\n"
 "\n"
 "Examples:\n"
@@ -188,6 +203,79 @@ Mpoly containment_filters(
 	DebugPlot *dbuf
 );
 
+typedef std::map<FeatureRawVal, FeatureBitmap::Index>::value_type feature_pair_t;
+
+// The polygons for one feature, ready to be written.
+struct FeatureOutput {
+	FeatureOutput() : done(false) { }
+
+	void swap(FeatureOutput &other) {
+		std::swap(done, other.done);
+		poly.rings.swap(other.poly.rings);
+		shapes.swap(other.shapes);
+	}
+
+	bool done;
+	Mpoly poly;
+	// indexed by shape (there are several with -split-polys) and then by
+	// geom output
+	std::vector<std::vector<Mpoly> > shapes;
+};
+
+// Everything needed to turn a feature into polygons.  The features don't
+// depend on each other, so with -classify several threads can each work on a
+// feature.  To bound memory use, only max_in_flight features past the last one
+// written may be started.
+struct FeaturePipeline {
+	FeaturePipeline() :
+		next_feature(0),
+		next_to_write(0),
+		max_in_flight(1)
+	{ }
+
+	bool classify;
+	const FeatureInterpreter *feature_interp;
+	FeatureBitmap *features_bitmap;
+	bool trace_all_features;
+	std::vector<Mpoly> *traced_features;
+	GDALDatasetH ds;
+	std::vector<size_t> inspect_bandids;
+	const NdvDef *ndv_def;
+	int num_threads;
+	DebugPlot *dbuf;
+	bool do_invert;
+	bool do_erosion;
+	int64_t min_ring_area;
+	bool trace_no_donuts;
+	bool output_no_donuts;
+	bool major_ring_only;
+	std::vector<ContainingOption> containing_options;
+	double bevel_size;
+	bool do_pinch_excursions;
+	std::string mask_out_fn;
+	double reduction_tolerance;
+	int per_feature_threads;
+	bool do_geom_output;
+	bool split_polys;
+	double llproj_toler;
+	std::vector<CoordSystem> out_cs_list;
+
+	std::vector<const feature_pair_t *> features;
+	std::vector<FeatureOutput> outputs;
+
+	// guards next_feature, next_to_write and outputs
+	boost::mutex lock;
+	boost::condition_variable cond;
+	size_t next_feature;
+	size_t next_to_write;
+	size_t max_in_flight;
+};
+
+void run_feature(FeaturePipeline &fp, size_t feature_idx, const GeoRef &georef,
+	FeatureOutput &output);
+
+void feature_worker(FeaturePipeline *fp, const GeoRef *georef);
+
 int main(int argc, char **argv) {
 	const std::string cmdname = argv[0];
 	if(argc == 1) usage(cmdname);
@@ -213,6 +301,7 @@ int main(int argc, char **argv) {
 	double bevel_size = .1;
 	bool do_pinch_excursions = 0;
 	std::vector<ContainingOption> containing_options;
+	int num_threads = 1;
 
 	GeoOpts geo_opts = GeoOpts(arg_list);
 	NdvDef ndv_def = NdvDef(arg_list);
@@ -305,6 +394,15 @@ int main(int argc, char **argv) {
 					opt.y = boost::lexical_cast<double>(arg_list[argp++]);
 
 					containing_options.push_back(opt);
+				} else if(arg == "-threads") {
+					if(argp == arg_list.size()) usage(cmdname);
+					num_threads = boost::lexical_cast<int>(arg_list[argp++]);
+					if(num_threads < 1) fatal_error("-threads must be at least 1");
+				} else if(arg == "-mem-limit") {
+					if(argp == arg_list.size()) usage(cmdname);
+					GRID_MEMORY_LIMIT = size_t(boost::lexical_cast<double>(arg_list[argp++]) * (1 << 20));
+				} else if(arg == "-coarse-to-fine") {
+					COARSE_TO_FINE = true;
 				} else if(arg == "-h" || arg == "--help") {
 					usage(cmdname);
 				} else {
@@ -430,96 +528,113 @@ int main(int argc, char **argv) {
 		features_list[FeatureRawVal()];
 	}
 
-	typedef std::map<FeatureRawVal, FeatureBitmap::Index>::value_type feature_pair_t;
-	size_t feature_idx = 0;
-	BOOST_FOREACH(const feature_pair_t &feature, features_list) {
-		Mpoly feature_poly;
-		{
-			BitGrid mask(0, 0);
-			if(classify) {
-				printf("\nTracing feature %s (%zd of %zd)\n",
-					feature_interp.pixel_to_string(feature.first).c_str(),
-					(++feature_idx), features_list.size());
-				mask = features_bitmap->get_mask_for_feature(feature.second);
-			} else {
-				printf("Reading raster.\n");
-				mask = get_bitgrid_for_dataset(ds, inspect_bandids, ndv_def, dbuf);
-			}
-
-			if(do_invert)  mask.invert();
-			if(do_erosion) mask.erode();
-
-			feature_poly = trace_mask(mask, georef.w, georef.h, min_ring_area, trace_no_donuts);
-		}
+	if(!containing_options.empty()) {
+		// We need to trace donuts even if not outputting them, in order to
+		// see if the polygons satisfy the containment options.  Ideally
+		// the user should be able to specify which happens first, hole
+		// removal or containment options.  Maybe there needs to be a
+		// rudimentary scripting language?  Or maybe just process the
+		// options in the order they are specified on the command line.
 
-		if(!containing_options.empty()) {
-			// We need to trace donuts even if not outputting them, in order to
-			// see if the polygons satisfy the containment options.  Ideally
-			// the user should be able to specify which happens first, hole
-			// removal or containment options.  Maybe there needs to be a
-			// rudimentary scripting language?  Or maybe just process the
-			// options in the order they are specified on the command line.
-
-			// Note: in this case, donuts must be removed later on!
-			trace_no_donuts = 0;
-		} else {
-			trace_no_donuts = output_no_donuts;
-			// If taking only the major ring, no holes are needed.
-			trace_no_donuts |= major_ring_only;
-		}
-		// If we are only taking the largest ring, and don't need to compute
-		// containments, then skip donuts for speed.
-		if(major_ring_only && containing_options.empty()) {
-			trace_no_donuts = 1;
-		}
-
-		if(VERBOSE) {
-			size_t num_inner = 0, num_outer = 0, total_pts = 0;
-			for(size_t r_idx=0; r_idx<feature_poly.rings.size(); r_idx++) {
-				if(feature_poly.rings[r_idx].is_hole) num_inner++;
-				else num_outer++;
-				total_pts += feature_poly.rings[r_idx].pts.size();
-			}
-			printf("tracer produced %zd rings (%zd outer, %zd holes) with a total of %zd points\n",
-				feature_poly.rings.size(), num_outer, num_inner, total_pts);
-		}
-
-		if(!feature_poly.rings.empty() && !containing_options.empty()) {
-			feature_poly = containment_filters(feature_poly, containing_options, georef, dbuf);
-		}
-
-		if(major_ring_only && feature_poly.rings.size() > 1) {
-			printf("Taking largest ring.\n");
-			feature_poly = take_largest_ring(feature_poly);
-		}
+		// Note: in this case, donuts must be removed later on!
+		trace_no_donuts = 0;
+	} else {
+		trace_no_donuts = output_no_donuts;
+		// If taking only the major ring, no holes are needed.
+		trace_no_donuts |= major_ring_only;
+	}
+	// If we are only taking the largest ring, and don't need to compute
+	// containments, then skip donuts for speed.
+	if(major_ring_only && containing_options.empty()) {
+		trace_no_donuts = 1;
+	}
 
-		if(output_no_donuts && !trace_no_donuts) {
-			// Hole removal was deferred until now.
-			printf("Removing donut holes.\n");
-			feature_poly = remove_holes(feature_poly);
-		}
+	// Unless the masks need to be eroded, all features can be traced with one
+	// pass over the raster rather than one pass per feature.
+	std::vector<Mpoly> traced_features;
+	bool trace_all_features = classify && !do_erosion;
+	if(trace_all_features) {
+		printf("\nTracing all features\n");
+		traced_features = features_bitmap->trace_features(min_ring_area, num_threads);
+	}
 
-		if(!feature_poly.rings.empty() && bevel_size > 0) {
-			// the topology cannot be resolved by us or by geos/jump/postgis if
-			// there are self-intersections
-			bevel_self_intersections(feature_poly, bevel_size);
-		}
+	FeaturePipeline fp;
+	fp.classify = classify;
+	fp.feature_interp = &feature_interp;
+	fp.features_bitmap = features_bitmap;
+	fp.trace_all_features = trace_all_features;
+	fp.traced_features = &traced_features;
+	fp.ds = ds;
+	fp.inspect_bandids = inspect_bandids;
+	fp.ndv_def = &ndv_def;
+	fp.num_threads = num_threads;
+	fp.dbuf = dbuf;
+	fp.do_invert = do_invert;
+	fp.do_erosion = do_erosion;
+	fp.min_ring_area = min_ring_area;
+	fp.trace_no_donuts = trace_no_donuts;
+	fp.output_no_donuts = output_no_donuts;
+	fp.major_ring_only = major_ring_only;
+	fp.containing_options = containing_options;
+	fp.bevel_size = bevel_size;
+	fp.do_pinch_excursions = do_pinch_excursions;
+	fp.mask_out_fn = mask_out_fn;
+	fp.reduction_tolerance = reduction_tolerance;
+	fp.do_geom_output = do_geom_output;
+	fp.split_polys = split_polys;
+	fp.llproj_toler = llproj_toler;
+	for(size_t go_idx=0; go_idx<geom_outputs.size(); go_idx++) {
+		fp.out_cs_list.push_back(geom_outputs[go_idx].out_cs);
+	}
+	BOOST_FOREACH(const feature_pair_t &feature, features_list) {
+		fp.features.push_back(&feature);
+	}
+	fp.outputs.resize(fp.features.size());
 
-		if(feature_poly.rings.size() && do_pinch_excursions) {
-			printf("Pinching excursions...\n");
-			feature_poly = pinch_excursions2(feature_poly, dbuf);
-			printf("Done pinching excursions.\n");
+	// The debug report is not thread safe, and neither is reading from a
+	// bitmap kept in a TiledStore.
+	size_t num_feature_threads = 1;
+	if(classify && !dbuf && !features_bitmap->is_tiled()) {
+		num_feature_threads = std::min(size_t(num_threads), fp.features.size());
+	}
+	// Each feature in flight holds a mask and its polygons, so don't get too
+	// far ahead of the writer.
+	fp.max_in_flight = 2 * num_feature_threads;
+	// If features are already being done in parallel, there are no spare
+	// threads for beveling or reducing each one's rings.
+	fp.per_feature_threads = num_feature_threads > 1 ? 1 : num_threads;
+
+	// Each thread gets its own copy of the coordinate transformations since
+	// they can't be shared between threads.
+	std::vector<GeoRef> worker_georefs;
+	boost::thread_group feature_threads;
+	if(num_feature_threads > 1) {
+		for(size_t i=0; i<num_feature_threads; i++) {
+			worker_georefs.push_back(georef.withOwnTransforms());
 		}
-
-		if(mask_out_fn.size()) {
-			mask_from_mpoly(feature_poly, georef.w, georef.h, mask_out_fn);
+		for(size_t i=0; i<num_feature_threads; i++) {
+			feature_threads.add_thread(new boost::thread(
+				feature_worker, &fp, &worker_georefs[i]));
 		}
+	}
 
-		if(feature_poly.rings.size() && reduction_tolerance > 0) {
-			Mpoly reduced_poly = compute_reduced_pointset(feature_poly, reduction_tolerance);
-			feature_poly = reduced_poly;
+	// Output is written from this thread, in feature order.
+	for(size_t feature_idx=0; feature_idx<fp.features.size(); feature_idx++) {
+		FeatureOutput output;
+		if(num_feature_threads > 1) {
+			boost::mutex::scoped_lock l(fp.lock);
+			while(!fp.outputs[feature_idx].done) fp.cond.wait(l);
+			output.swap(fp.outputs[feature_idx]);
+			fp.next_to_write++;
+			fp.cond.notify_all();
+			printf("\nTracing feature %s (%zd of %zd)\n",
+				feature_interp.pixel_to_string(fp.features[feature_idx]->first).c_str(),
+				feature_idx+1, fp.features.size());
+		} else {
+			run_feature(fp, feature_idx, georef, output);
 		}
 
+		const Mpoly &feature_poly = output.poly;
 		if(feature_poly.rings.empty()) {
 			printf("WARNING! No rings found!\n");
 		} else {
@@ -539,29 +654,11 @@ int main(int argc, char **argv) {
 			if(do_geom_output && feature_poly.rings.size()) {
 				printf("Writing output\n");
 
-				std::vector<Mpoly> shapes;
-				if(split_polys) {
-					shapes = split_mpoly_to_polys(feature_poly);
-				} else {
-					shapes.push_back(feature_poly);
-				}
-
-				for(size_t shape_idx=0; shape_idx<shapes.size(); shape_idx++) {
-					const Mpoly &poly_in = shapes[shape_idx];
-
+				for(size_t shape_idx=0; shape_idx<output.shapes.size(); shape_idx++) {
 					for(size_t go_idx=0; go_idx<geom_outputs.size(); go_idx++) {
 						GeomOutput &go = geom_outputs[go_idx];
 
-						Mpoly proj_poly = poly_in;
-						if(go.out_cs == CS_XY) {
-							// no-op
-						} else if(go.out_cs == CS_EN) {
-							proj_poly.xy2en(georef);
-						} else if(go.out_cs == CS_LL) {
-							proj_poly.xy2ll_with_interp(georef, llproj_toler);
-						} else {
-							fatal_error("bad val for out_cs");
-						}
+						const Mpoly &proj_poly = output.shapes[shape_idx][go_idx];
 
 						OGRGeometryH ogr_geom = mpoly_to_ogr(proj_poly);
 
@@ -582,7 +679,8 @@ int main(int argc, char **argv) {
 							OGRFeatureH ogr_feat = OGR_F_Create(OGR_L_GetLayerDefn(go.ogr_layer));
 
 							if(classify) {
-								feature_interp.set_ogr_fields(go.ogr_layer, ogr_feat, feature.first);
+								feature_interp.set_ogr_fields(go.ogr_layer, ogr_feat,
+									fp.features[feature_idx]->first);
 							}
 
 							OGR_F_SetGeometryDirectly(ogr_feat, ogr_geom); // assumes ownership of geom
@@ -599,6 +697,11 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	feature_threads.join_all();
+	for(size_t i=0; i<worker_georefs.size(); i++) {
+		worker_georefs[i].destroyTransforms();
+	}
+
 	printf("\n");
 
 	delete(features_bitmap);
@@ -624,6 +727,174 @@ int main(int argc, char **argv) {
 	return 0;
 }
 
+void run_feature(FeaturePipeline &fp, size_t feature_idx, const GeoRef &georef,
+	FeatureOutput &output
+) {
+	const feature_pair_t &feature = *fp.features[feature_idx];
+
+	Mpoly feature_poly;
+	{
+		// If nothing needs to be done to the mask before tracing, the trace
+		// can be done while the mask is being read.
+		bool trace_while_reading = !fp.classify && !fp.do_invert && !fp.do_erosion;
+
+		BitGrid mask(0, 0);
+		// position of the mask within the raster, if it has been cropped
+		int mask_off_x = 0, mask_off_y = 0;
+		if(fp.classify) {
+			status_printf("\nTracing feature %s (%zd of %zd)\n",
+				fp.feature_interp->pixel_to_string(feature.first).c_str(),
+				feature_idx+1, fp.features.size());
+			if(fp.trace_all_features) {
+				// already traced
+			} else if(fp.do_invert) {
+				mask = fp.features_bitmap->get_mask_for_feature(feature.second);
+			} else {
+				// Everything outside of the feature's bounding box is false, and stays
+				// false after erosion, so only that box needs to be traced.
+				mask = fp.features_bitmap->get_cropped_mask_for_feature(
+					feature.second, &mask_off_x, &mask_off_y);
+			}
+		} else {
+			status_printf("Reading raster.\n");
+			if(!trace_while_reading) {
+				mask = get_bitgrid_for_dataset(fp.ds, fp.inspect_bandids, *fp.ndv_def,
+					fp.dbuf, fp.num_threads);
+			}
+		}
+
+		if(trace_while_reading) {
+			feature_poly = trace_dataset_mask(fp.ds, fp.inspect_bandids, *fp.ndv_def,
+				fp.dbuf, fp.num_threads, fp.min_ring_area, fp.trace_no_donuts);
+		} else if(fp.trace_all_features) {
+			feature_poly.rings.swap((*fp.traced_features)[feature.second].rings);
+			// same as what trace_mask would have done with no_donuts set
+			if(fp.trace_no_donuts) feature_poly = remove_holes(feature_poly);
+		} else {
+			if(fp.do_invert)  mask.invert();
+			if(fp.do_erosion) mask.erode();
+
+			feature_poly = trace_mask(mask, mask.width(), mask.height(),
+				fp.min_ring_area, fp.trace_no_donuts);
+			if(mask_off_x || mask_off_y) feature_poly.translate(mask_off_x, mask_off_y);
+		}
+	}
+
+	if(VERBOSE) {
+		size_t num_inner = 0, num_outer = 0, total_pts = 0;
+		for(size_t r_idx=0; r_idx<feature_poly.rings.size(); r_idx++) {
+			if(feature_poly.rings[r_idx].is_hole) num_inner++;
+			else num_outer++;
+			total_pts += feature_poly.rings[r_idx].pts.size();
+		}
+		status_printf("tracer produced %zd rings (%zd outer, %zd holes) with a total of %zd points\n",
+			feature_poly.rings.size(), num_outer, num_inner, total_pts);
+	}
+
+	if(!feature_poly.rings.empty() && !fp.containing_options.empty()) {
+		feature_poly = containment_filters(feature_poly, fp.containing_options, georef, fp.dbuf);
+	}
+
+	if(fp.major_ring_only && feature_poly.rings.size() > 1) {
+		status_printf("Taking largest ring.\n");
+		feature_poly = take_largest_ring(feature_poly);
+	}
+
+	if(fp.output_no_donuts && !fp.trace_no_donuts) {
+		// Hole removal was deferred until now.
+		status_printf("Removing donut holes.\n");
+		feature_poly = remove_holes(feature_poly);
+	}
+
+	if(!feature_poly.rings.empty() && fp.bevel_size > 0) {
+		// the topology cannot be resolved by us or by geos/jump/postgis if
+		// there are self-intersections
+		bevel_self_intersections(feature_poly, fp.bevel_size, fp.per_feature_threads);
+	}
+
+	if(feature_poly.rings.size() && fp.do_pinch_excursions) {
+		status_printf("Pinching excursions...\n");
+		feature_poly = pinch_excursions2(feature_poly, fp.dbuf);
+		status_printf("Done pinching excursions.\n");
+	}
+
+	if(fp.mask_out_fn.size()) {
+		mask_from_mpoly(feature_poly, georef.w, georef.h, fp.mask_out_fn);
+	}
+
+	if(feature_poly.rings.size() && fp.reduction_tolerance > 0) {
+		Mpoly reduced_poly = compute_reduced_pointset(feature_poly, fp.reduction_tolerance,
+			fp.per_feature_threads);
+		feature_poly = reduced_poly;
+	}
+
+	if(fp.do_geom_output && feature_poly.rings.size()) {
+		std::vector<Mpoly> shapes;
+		if(fp.split_polys) {
+			shapes = split_mpoly_to_polys(feature_poly);
+		} else {
+			shapes.push_back(feature_poly);
+		}
+
+		output.shapes.resize(shapes.size());
+		for(size_t shape_idx=0; shape_idx<shapes.size(); shape_idx++) {
+			const Mpoly &poly_in = shapes[shape_idx];
+
+			for(size_t go_idx=0; go_idx<fp.out_cs_list.size(); go_idx++) {
+				CoordSystem out_cs = fp.out_cs_list[go_idx];
+
+				Mpoly proj_poly = poly_in;
+				if(out_cs == CS_XY) {
+					// no-op
+				} else if(out_cs == CS_EN) {
+					proj_poly.xy2en(georef);
+				} else if(out_cs == CS_LL) {
+					proj_poly.xy2ll_with_interp(georef, fp.llproj_toler, fp.per_feature_threads);
+				} else {
+					fatal_error("bad val for out_cs");
+				}
+
+				output.shapes[shape_idx].push_back(proj_poly);
+			}
+		}
+	}
+
+	output.poly.rings.swap(feature_poly.rings);
+	output.done = true;
+}
+
+void feature_worker(FeaturePipeline *fp, const GeoRef *georef) {
+	// error handlers are per-thread
+	CPLPushErrorHandler(CPLQuietErrorHandler);
+	// Progress is reported by the writer thread instead.
+	set_thread_quiet(true);
+
+	for(;;) {
+		size_t feature_idx;
+		{
+			boost::mutex::scoped_lock l(fp->lock);
+			while(fp->next_feature < fp->features.size() &&
+				fp->next_feature >= fp->next_to_write + fp->max_in_flight
+			) {
+				fp->cond.wait(l);
+			}
+			if(fp->next_feature == fp->features.size()) break;
+			feature_idx = fp->next_feature++;
+		}
+
+		FeatureOutput output;
+		run_feature(*fp, feature_idx, *georef, output);
+
+		{
+			boost::mutex::scoped_lock l(fp->lock);
+			fp->outputs[feature_idx].swap(output);
+			fp->cond.notify_all();
+		}
+	}
+
+	CPLPopErrorHandler();
+}
+
 Mpoly take_largest_ring(const Mpoly &mp_in) {
 	double biggest_area = 0;
 	size_t best_idx = 0;
@@ -664,10 +935,15 @@ Mpoly containment_filters(
 	const GeoRef &georef,
 	DebugPlot *dbuf
 ) {
-	std::vector<Vertex> wanted_pts;
-	std::vector<Vertex> unwanted_pts;
-	BOOST_FOREACH(const ContainingOption &opt, containing_options) {
-		Vertex v;
+	// The points given in en or ll are converted all together, one array
+	// per coordinate system.
+	size_t num_opts = containing_options.size();
+	std::vector<Vertex> opt_pts(num_opts);
+	std::vector<size_t> en_idx, ll_idx;
+	std::vector<double> en_x, en_y, ll_x, ll_y;
+	for(size_t i=0; i<num_opts; i++) {
+		const ContainingOption &opt = containing_options[i];
+		Vertex &v = opt_pts[i];
 		switch(opt.cs) {
 			case CS_XY:
 				v.x = opt.x;
@@ -678,15 +954,38 @@ Mpoly containment_filters(
 				v.y = opt.y / 100.0 * georef.h;
 				break;
 			case CS_EN:
-				georef.en2xy(opt.x, opt.y, &v.x, &v.y);
+				en_idx.push_back(i);
+				en_x.push_back(opt.x);
+				en_y.push_back(opt.y);
 				break;
 			case CS_LL:
-				georef.ll2xy(opt.x, opt.y, &v.x, &v.y);
+				ll_idx.push_back(i);
+				ll_x.push_back(opt.x);
+				ll_y.push_back(opt.y);
 				break;
 			default:
 				fatal_error("coord system not implemented");
 		};
-		if(opt.wanted_point) {
+	}
+	if(!en_idx.empty()) {
+		georef.en2xy(en_idx.size(), &en_x[0], &en_y[0], &en_x[0], &en_y[0]);
+		for(size_t j=0; j<en_idx.size(); j++) {
+			opt_pts[en_idx[j]] = Vertex(en_x[j], en_y[j]);
+		}
+	}
+	if(!ll_idx.empty()) {
+		std::vector<double> x(ll_idx.size()), y(ll_idx.size());
+		georef.ll2xy_or_die(ll_idx.size(), &ll_x[0], &ll_y[0], &x[0], &y[0]);
+		for(size_t j=0; j<ll_idx.size(); j++) {
+			opt_pts[ll_idx[j]] = Vertex(x[j], y[j]);
+		}
+	}
+
+	std::vector<Vertex> wanted_pts;
+	std::vector<Vertex> unwanted_pts;
+	for(size_t i=0; i<num_opts; i++) {
+		const Vertex &v = opt_pts[i];
+		if(containing_options[i].wanted_point) {
 			wanted_pts.push_back(v);
 			dbuf->plotPointBig(v.x, v.y, 0, 255, 0);
 		} else {
@@ -699,20 +998,20 @@ Mpoly containment_filters(
 		fatal_error("no wanted/unwanted pts given");
 	}
 
-	printf("Looking for polygons");
+	status_printf("Looking for polygons");
 	if(!wanted_pts.empty()) {
-		printf(" containing:");
+		status_printf(" containing:");
 		BOOST_FOREACH(const Vertex &v, wanted_pts) {
-			printf(" (%.1f,%.1f)", v.x, v.y);
+			status_printf(" (%.1f,%.1f)", v.x, v.y);
 		}
 	}
 	if(!unwanted_pts.empty()) {
-		printf(" not containing:");
+		status_printf(" not containing:");
 		BOOST_FOREACH(const Vertex &v, unwanted_pts) {
-			printf(" (%.1f,%.1f)", v.x, v.y);
+			status_printf(" (%.1f,%.1f)", v.x, v.y);
 		}
 	}
-	printf("\n");
+	status_printf("\n");
 
 	Mpoly new_mp;
 	std::map<int, int> relabeling;
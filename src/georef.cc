@@ -27,12 +27,14 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 
 
 #include <string>
+#include <algorithm>
 #include <cassert>
 
 #include <boost/lexical_cast.hpp>
 
 #include "common.h"
 #include "georef.h"
+#include "polygon.h"
 
 static const double EPSILON = 1e-9;
 
@@ -364,6 +366,22 @@ void GeoRef::en2ll_or_die(
 	}
 }
 
+// This will add a multiple of 360 degrees in order to bring the
+// coordinate into the proper range.  This is needed because
+// OCTTransform will usually return a number in the -180..180
+// range, but the raster may be defined on, for example, a range
+// of 0..360.
+double GeoRef::wrapEast(double east) const {
+	if(lon_loopsize) {
+		double east_orig = east;
+		while(east < lon_range1) east += lon_loopsize;
+		while(east > lon_range2) east -= lon_loopsize;
+		if(east < lon_range1) east = east_orig;
+		//printf("%g => %g\n", east_orig, east);
+	}
+	return east;
+}
+
 bool GeoRef::ll2en(
 	double lon, double lat,
 	double *e_out, double *n_out
@@ -385,20 +403,7 @@ bool GeoRef::ll2en(
 	double east = u;
 	double north = v;
 
-	// This will add a multiple of 360 degrees in order to bring the
-	// coordinate into the proper range.  This is needed because
-	// OCTTransform will usually return a number in the -180..180
-	// range, but the raster may be defined on, for example, a range
-	// of 0..360.
-	if(lon_loopsize) {
-		double east_orig = east;
-		while(east < lon_range1) east += lon_loopsize;
-		while(east > lon_range2) east -= lon_loopsize;
-		if(east < lon_range1) east = east_orig;
-		//printf("%g => %g\n", east_orig, east);
-	}
-
-	*e_out = east;
+	*e_out = wrapEast(east);
 	*n_out = north;
 	return 0;
 }
@@ -430,6 +435,175 @@ void GeoRef::xy2ll_or_die(
 	en2ll_or_die(east, north, lon_out, lat_out);
 }
 
+void GeoRef::xy2en(
+	size_t n, const double *x, const double *y,
+	double *e_out, double *n_out
+) const {
+	if(!hasAffine()) fatal_error("missing affine");
+	const double a0 = fwd_affine[0], a1 = fwd_affine[1], a2 = fwd_affine[2];
+	const double a3 = fwd_affine[3], a4 = fwd_affine[4], a5 = fwd_affine[5];
+	for(size_t i=0; i<n; i++) {
+		double xpos = x[i];
+		double ypos = y[i];
+		e_out[i] = a0 + a1 * xpos + a2 * ypos;
+		n_out[i] = a3 + a4 * xpos + a5 * ypos;
+	}
+}
+
+void GeoRef::en2xy(
+	size_t n, const double *east, const double *north,
+	double *x_out, double *y_out
+) const {
+	if(!hasAffine()) fatal_error("missing affine");
+	const double a0 = inv_affine[0], a1 = inv_affine[1], a2 = inv_affine[2];
+	const double a3 = inv_affine[3], a4 = inv_affine[4], a5 = inv_affine[5];
+	for(size_t i=0; i<n; i++) {
+		double e = east[i];
+		double nn = north[i];
+		x_out[i] = a0 + a1 * e + a2 * nn;
+		y_out[i] = a3 + a4 * e + a5 * nn;
+	}
+}
+
+void GeoRef::xy2en(std::vector<Vertex> &pts) const {
+	if(!hasAffine()) fatal_error("missing affine");
+	const double a0 = fwd_affine[0], a1 = fwd_affine[1], a2 = fwd_affine[2];
+	const double a3 = fwd_affine[3], a4 = fwd_affine[4], a5 = fwd_affine[5];
+	for(size_t i=0; i<pts.size(); i++) {
+		double xpos = pts[i].x;
+		double ypos = pts[i].y;
+		pts[i].x = a0 + a1 * xpos + a2 * ypos;
+		pts[i].y = a3 + a4 * xpos + a5 * ypos;
+	}
+}
+
+void GeoRef::en2xy(std::vector<Vertex> &pts) const {
+	if(!hasAffine()) fatal_error("missing affine");
+	const double a0 = inv_affine[0], a1 = inv_affine[1], a2 = inv_affine[2];
+	const double a3 = inv_affine[3], a4 = inv_affine[4], a5 = inv_affine[5];
+	for(size_t i=0; i<pts.size(); i++) {
+		double e = pts[i].x;
+		double nn = pts[i].y;
+		pts[i].x = a0 + a1 * e + a2 * nn;
+		pts[i].y = a3 + a4 * e + a5 * nn;
+	}
+}
+
+static bool lonlat_in_range(double lon, double lat) {
+	// same limits as en2ll and ll2en
+	if(lat < -90.0-EPSILON || lat > 90.0+EPSILON) return false;
+	if(lon < -360.0-EPSILON || lon > 540.0+EPSILON) return false;
+	return true;
+}
+
+// Transforms n points in place, with as few calls to OCTTransform as
+// possible.  Returns false if any of the calls failed.
+static bool transform_in_place(
+	OGRCoordinateTransformationH xform,
+	size_t n, double *u, double *v
+) {
+	// OCTTransform takes an int count
+	const size_t max_batch = 1 << 20;
+	for(size_t begin=0; begin<n; begin+=max_batch) {
+		size_t batch = std::min(n - begin, max_batch);
+		if(!OCTTransform(xform, int(batch), u+begin, v+begin, NULL)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void GeoRef::en2ll_or_die(
+	size_t n, const double *east, const double *north,
+	double *lon_out, double *lat_out
+) const {
+	if(!fwd_xform) fatal_error("missing xform");
+
+	std::copy(east, east+n, lon_out);
+	std::copy(north, north+n, lat_out);
+	bool ok = transform_in_place(fwd_xform, n, lon_out, lat_out);
+	for(size_t i=0; ok && i<n; i++) {
+		ok = lonlat_in_range(lon_out[i], lat_out[i]);
+	}
+	if(!ok) {
+		// Go through them one at a time, to find which point failed
+		// and report it the usual way.
+		for(size_t i=0; i<n; i++) {
+			en2ll_or_die(east[i], north[i], &lon_out[i], &lat_out[i]);
+		}
+	}
+}
+
+void GeoRef::ll2en_or_die(
+	size_t n, const double *lon, const double *lat,
+	double *e_out, double *n_out
+) const {
+	if(!inv_xform) fatal_error("missing xform");
+
+	bool ok = true;
+	for(size_t i=0; ok && i<n; i++) {
+		ok = lonlat_in_range(lon[i], lat[i]);
+	}
+	if(ok) {
+		std::copy(lon, lon+n, e_out);
+		std::copy(lat, lat+n, n_out);
+		ok = transform_in_place(inv_xform, n, e_out, n_out);
+	}
+	if(ok) {
+		for(size_t i=0; i<n; i++) {
+			e_out[i] = wrapEast(e_out[i]);
+		}
+	} else {
+		for(size_t i=0; i<n; i++) {
+			ll2en_or_die(lon[i], lat[i], &e_out[i], &n_out[i]);
+		}
+	}
+}
+
+void GeoRef::xy2ll_or_die(
+	size_t n, const double *x, const double *y,
+	double *lon_out, double *lat_out
+) const {
+	if(!fwd_xform) fatal_error("missing xform");
+
+	xy2en(n, x, y, lon_out, lat_out);
+	bool ok = transform_in_place(fwd_xform, n, lon_out, lat_out);
+	for(size_t i=0; ok && i<n; i++) {
+		ok = lonlat_in_range(lon_out[i], lat_out[i]);
+	}
+	if(!ok) {
+		for(size_t i=0; i<n; i++) {
+			xy2ll_or_die(x[i], y[i], &lon_out[i], &lat_out[i]);
+		}
+	}
+}
+
+void GeoRef::ll2xy_or_die(
+	size_t n, const double *lon, const double *lat,
+	double *x_out, double *y_out
+) const {
+	if(!hasAffine()) fatal_error("missing affine");
+
+	ll2en_or_die(n, lon, lat, x_out, y_out);
+	en2xy(n, x_out, y_out, x_out, y_out);
+}
+
+GeoRef GeoRef::withOwnTransforms() const {
+	GeoRef ret = *this;
+	if(spatial_ref) {
+		ret.fwd_xform = OCTNewCoordinateTransformation(spatial_ref, geo_sref);
+		ret.inv_xform = OCTNewCoordinateTransformation(geo_sref, spatial_ref);
+	}
+	return ret;
+}
+
+void GeoRef::destroyTransforms() {
+	if(fwd_xform) OCTDestroyCoordinateTransformation(fwd_xform);
+	if(inv_xform) OCTDestroyCoordinateTransformation(inv_xform);
+	fwd_xform = NULL;
+	inv_xform = NULL;
+}
+
 bool GeoRef::ll2xy(
 	double lon, double lat,
 	double *x_out, double *y_out
@@ -35,6 +35,8 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 
 namespace dangdal {
 
+struct Vertex;
+
 struct GeoOpts {
 	static void printUsage();
 	explicit GeoOpts(std::vector<std::string> &arg_list);
@@ -65,6 +67,33 @@ public:
 	void xy2ll_or_die(double x, double y, double *lon_out, double *lat_out) const;
 	void ll2xy_or_die(double lon, double lat, double *x_out, double *y_out) const;
 
+	// Array versions of the above, for n points at a time.  The affine step
+	// is a plain loop over the arrays and the projection is one call to
+	// OCTTransform per batch, which is much faster than a call per point.
+	void xy2en(size_t n, const double *x, const double *y,
+		double *e_out, double *n_out) const;
+	void en2xy(size_t n, const double *east, const double *north,
+		double *x_out, double *y_out) const;
+	// These convert the points in place.
+	void xy2en(std::vector<Vertex> &pts) const;
+	void en2xy(std::vector<Vertex> &pts) const;
+	// For these the output arrays must not overlap the input ones.  If any
+	// point fails, the error is the same as from the single point versions.
+	void en2ll_or_die(size_t n, const double *east, const double *north,
+		double *lon_out, double *lat_out) const;
+	void ll2en_or_die(size_t n, const double *lon, const double *lat,
+		double *e_out, double *n_out) const;
+	void xy2ll_or_die(size_t n, const double *x, const double *y,
+		double *lon_out, double *lat_out) const;
+	void ll2xy_or_die(size_t n, const double *lon, const double *lat,
+		double *x_out, double *y_out) const;
+
+	// The coordinate transformations can't be used by two threads at once.
+	// This returns a copy with transformations of its own, which should be
+	// freed with destroyTransforms() when done.
+	GeoRef withOwnTransforms() const;
+	void destroyTransforms();
+
 	std::string s_srs;
 	std::string geo_srs;
 	double res_x, res_y; // zero if there is rotation
@@ -81,6 +110,9 @@ public:
 	std::vector<double> fwd_affine;
 	std::vector<double> inv_affine;
 	double lon_range1, lon_range2, lon_loopsize;
+
+private:
+	double wrapEast(double east) const;
 };
 
 } // namespace dangdal
@@ -26,8 +26,14 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 
 
 
+#include <algorithm>
+#include <functional>
+#include <queue>
 #include <vector>
 
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
 #include "mask.h"
 #include "mask-tracer.h"
 #include "common.h"
@@ -46,7 +52,8 @@ enum Direction {
 typedef int pixquad_t;
 
 int dbg_idx = 0;
-static void debug_write_mask(const BitGrid &mask, size_t w, size_t h) {
+template <typename Mask>
+static void debug_write_mask(const Mask &mask, size_t w, size_t h) {
 	char fn[1000];
 	snprintf(fn, sizeof(fn), "zz-debug-%04d.pgm", dbg_idx++);
 
@@ -66,21 +73,11 @@ static void debug_write_mask(const BitGrid &mask, size_t w, size_t h) {
 	delete[] row;
 }
 
-static Ring make_enclosing_ring(size_t w, size_t h) {
-	Ring ring;
-	ring.pts.reserve(4);
-	ring.pts.push_back(Vertex(-1, -1));
-	ring.pts.push_back(Vertex( w, -1));
-	ring.pts.push_back(Vertex( w,  h));
-	ring.pts.push_back(Vertex(-1,  h));
-	return ring;
-}
-
-static int64_t compute_area(const std::vector<row_crossings_t> &crossings) {
+static int64_t compute_area(const RowCrossingsTable &crossings) {
 	int64_t area = 0;
-	for(size_t y=0; y<crossings.size(); y++) {
-		const row_crossings_t &rc = crossings[y];
-		size_t nc = rc.size();
+	for(size_t y=0; y<crossings.num_rows(); y++) {
+		const int *rc = crossings.row(y);
+		size_t nc = crossings.row_size(y);
 		for(size_t cidx=0; cidx<nc/2; cidx++) {
 			int from = rc[cidx*2  ];
 			int to   = rc[cidx*2+1];
@@ -90,42 +87,441 @@ static int64_t compute_area(const std::vector<row_crossings_t> &crossings) {
 	return area;
 }
 
-/*
-static int is_inside_crossings(row_crossings_t *c, int x) {
-	int inside = 0;
-	for(int i=0; i<c->num_crossings; i++) {
-		if(x >= c->crossings[i]) inside = !inside;
-	}
-	return inside;
+static inline pixquad_t rotate_quad(pixquad_t q, int dir) {
+	return ((q + (q<<4)) >> dir) & 0xf;
 }
-*/
 
-static inline pixquad_t get_quad(const BitGrid &mask, int x, int y, bool select_color) {
-	// 1 2
-	// 8 4
-	pixquad_t quad =
-		(mask.get(x-1, y-1, 0) ? 1 : 0) +
-		(mask.get(x  , y-1, 0) ? 2 : 0) +
-		(mask.get(x  , y  , 0) ? 4 : 0) +
-		(mask.get(x-1, y  , 0) ? 8 : 0);
-	if(!select_color) quad ^= 0xf;
-	return quad;
+// The tracer works on a grid of classes (a mask has two: 0 and 1) and finds,
+// for each wanted class c, rings alternately around 4-connected regions of c
+// pixels (outer rings) and of non-c pixels (holes).  Each ring's children are
+// the regions of the other kind inside of it which aren't inside of an
+// earlier sibling, earlier meaning that its top-left pixel comes first in
+// raster order.  Rings are listed depth first, children in that same order.
+//
+// This is done in a single scan of the raster in row order, without
+// modifying it, keeping for each class the stack of its rings that contain
+// the current pixel.  A ring is traced when the scan reaches its top-left
+// corner, and whether it is part of the output (and under which parent) is
+// decided by looking down that stack.  Rings which are not output still need
+// to be traced, since they can hide the regions inside of them.
+
+// Views of the pixels for ClassTracer.  class_at gives -1 off the edge of the
+// grid.  next_edge(y, x0, x1) skips ahead from x0 to the first pixel of row y
+// that differs from the one above it, giving x1 if there is none before that.
+// Pixels that can't start a ring may be returned too.  span_end(x, y) gives
+// the first pixel after x where the class of row y or of the row above it
+// changes, or w.  span_start(x, y) gives the first pixel of that same span,
+// the first x0 <= x such that neither row changes between x0 and x.  For
+// these, y can be anything from 0 to h.
+
+// Only the 'true' pixels of a mask are traced.  If rows_ready is given, the
+// mask is still being filled in by another thread, and rows are waited for
+// before being looked at.
+class MaskClasses {
+public:
+	explicit MaskClasses(const BitGrid &_mask, RowsReady *_rows_ready=NULL) :
+		mask(_mask), w(_mask.width()), h(_mask.height()),
+		rows_ready(_rows_ready), num_ready(_rows_ready ? 0 : _mask.height())
+	{ }
+
+	size_t num_classes() const { return 2; }
+	bool wanted(int cls) const { return cls == 1; }
+
+	int class_at(int x, int y) const {
+		if(x>=0 && y>=0 && x<w && y<h) {
+			if(y >= num_ready) num_ready = rows_ready->wait_for(y);
+			return mask(x, y) ? 1 : 0;
+		}
+		return -1;
+	}
+
+	int next_edge(int y, int x, int x1) const {
+		if(y >= num_ready) num_ready = rows_ready->wait_for(y);
+		if(y == 0) return mask.find_next(0, x, x1, true);
+		return mask.find_next_change(y, x, x1);
+	}
+
+	int span_end(int x, int y) const {
+		int x1 = w;
+		if(y < h) {
+			if(y >= num_ready) num_ready = rows_ready->wait_for(y);
+			x1 = mask.find_next(y, x+1, x1, !mask(x, y));
+		}
+		if(y > 0) {
+			if(y-1 >= num_ready) num_ready = rows_ready->wait_for(y-1);
+			x1 = mask.find_next(y-1, x+1, x1, !mask(x, y-1));
+		}
+		return x1;
+	}
+
+	int span_start(int x, int y) const {
+		int x0 = 0;
+		if(y < h) {
+			if(y >= num_ready) num_ready = rows_ready->wait_for(y);
+			x0 = mask.find_prev(y, x0, x, !mask(x, y)) + 1;
+		}
+		if(y > 0) {
+			if(y-1 >= num_ready) num_ready = rows_ready->wait_for(y-1);
+			x0 = mask.find_prev(y-1, x0, x, !mask(x, y-1)) + 1;
+		}
+		return x0;
+	}
+
+private:
+	const BitGrid &mask;
+	const int w, h;
+	RowsReady *rows_ready;
+	// rows known to be filled in
+	mutable int num_ready;
+};
+
+// Only the classes whose entry in class_group is equal to group are traced,
+// so that the classes can be split up between several tracers.
+template <typename T>
+class IndexClasses {
+public:
+	IndexClasses(const GridArray<T> &_classes, size_t _w, size_t _h,
+		const std::vector<int> &_class_group, int _group
+	) :
+		classes(_classes), w(_w), h(_h),
+		class_group(_class_group), group(_group)
+	{ }
+
+	size_t num_classes() const { return class_group.size(); }
+	bool wanted(int cls) const { return class_group[cls] == group; }
+
+	int class_at(int x, int y) const {
+		if(x>=0 && y>=0 && x<w && y<h) return classes(x, y);
+		return -1;
+	}
+
+	int next_edge(int y, int x, int x1) const {
+		if(y == 0) return x;
+		while(x < x1 && classes(x, y) == classes(x, y-1)) x++;
+		return x;
+	}
+
+	int span_end(int x, int y) const {
+		int above = class_at(x, y-1);
+		int below = class_at(x, y);
+		do x++; while(x < w && class_at(x, y-1) == above && class_at(x, y) == below);
+		return x;
+	}
+
+	int span_start(int x, int y) const {
+		int above = class_at(x, y-1);
+		int below = class_at(x, y);
+		while(x > 0 && class_at(x-1, y-1) == above && class_at(x-1, y) == below) x--;
+		return x;
+	}
+
+private:
+	const GridArray<T> &classes;
+	const int w, h;
+	const std::vector<int> &class_group;
+	const int group;
+};
+
+// Same as MaskClasses, for an RleMask.  The tracer then takes time in
+// proportion to the number of runs rather than the number of pixels.
+class RleClasses {
+public:
+	explicit RleClasses(const RleMask &_mask, RowsReady *_rows_ready=NULL) :
+		mask(_mask), w(_mask.width()), h(_mask.height()),
+		rows_ready(_rows_ready), num_ready(_rows_ready ? 0 : _mask.height())
+	{ }
+
+	size_t num_classes() const { return 2; }
+	bool wanted(int cls) const { return cls == 1; }
+
+	int class_at(int x, int y) const {
+		if(x>=0 && y>=0 && x<w && y<h) {
+			// The tracer looks at two rows at a time, near to where it last
+			// looked, so a search of the row is seldom needed.
+			CachedRun &c = cache[y & 1];
+			if(c.y != y || x < c.x0 || x >= c.x1) {
+				if(y >= num_ready) num_ready = rows_ready->wait_for(y);
+				const RleMask::runs_t &r = mask.runs(y);
+				size_t i;
+				if(c.y == y && x >= c.x1 && (c.i+1 == r.size() || x < r[c.i+1])) {
+					i = c.i + 1;
+				} else if(c.y == y && x < c.x0 && (c.i == 1 || x >= r[c.i-2])) {
+					i = c.i - 1;
+				} else {
+					i = std::upper_bound(r.begin(), r.end(), x) - r.begin();
+				}
+				c.y = y;
+				c.i = i;
+				c.x0 = i ? r[i-1] : 0;
+				c.x1 = i < r.size() ? r[i] : w;
+				c.cls = i & 1;
+			}
+			return c.cls;
+		}
+		return -1;
+	}
+
+	int next_edge(int y, int x, int x1) const {
+		if(y >= num_ready) num_ready = rows_ready->wait_for(y);
+		if(y == 0) {
+			if(x < x1 && !mask(x, 0)) x = mask.run_end(0, x);
+			return std::min(x, x1);
+		}
+		return mask.find_next_change(y, x, x1);
+	}
+
+	int span_end(int x, int y) const {
+		int x1 = w;
+		if(y < h) {
+			if(y >= num_ready) num_ready = rows_ready->wait_for(y);
+			x1 = mask.run_end(y, x);
+		}
+		if(y > 0) {
+			if(y-1 >= num_ready) num_ready = rows_ready->wait_for(y-1);
+			x1 = std::min(x1, mask.run_end(y-1, x));
+		}
+		return x1;
+	}
+
+	int span_start(int x, int y) const {
+		int x0 = 0;
+		if(y < h) {
+			if(y >= num_ready) num_ready = rows_ready->wait_for(y);
+			x0 = mask.run_start(y, x);
+		}
+		if(y > 0) {
+			if(y-1 >= num_ready) num_ready = rows_ready->wait_for(y-1);
+			x0 = std::max(x0, mask.run_start(y-1, x));
+		}
+		return x0;
+	}
+
+private:
+	// Pixels x0 <= x < x1 of row y are of class cls.  They come after i of
+	// the run ends of the row.
+	struct CachedRun {
+		CachedRun() : y(-1), x0(0), x1(0), cls(0), i(0) { }
+		int y, x0, x1, cls;
+		size_t i;
+	};
+
+	const RleMask &mask;
+	const int w, h;
+	RowsReady *rows_ready;
+	// rows known to be filled in
+	mutable int num_ready;
+	// for even and odd rows
+	mutable CachedRun cache[2];
+};
+
+struct ClassRing {
+	ClassRing(int _cls, bool _is_hole) :
+		cls(_cls), is_hole(_is_hole), output(false), blocking(false), on_stack(false)
+	{ }
+
+	int cls;
+	// if true, the ring goes around pixels that are not of class cls
+	bool is_hole;
+	bool output;
+	// nothing inside of this ring gets output (it was smaller than min_area,
+	// or no_donuts is set)
+	bool blocking;
+	bool on_stack;
+	// only filled in for rings that are output
+	Ring ring;
+	std::vector<size_t> children;
+};
+
+// The ring ring_id has an edge on the left side of pixel (x,y), where y is the
+// row the crossing is filed under.
+struct RingCrossing {
+	RingCrossing(int _x, size_t _ring_id) : x(_x), ring_id(_ring_id) { }
+
+	bool operator<(const RingCrossing &other) const { return x < other.x; }
+	bool operator>(const RingCrossing &other) const { return x > other.x; }
+
+	int x;
+	size_t ring_id;
+};
+
+// The pixels x0 <= x < x1 of a row.
+struct MarkedSpan {
+	MarkedSpan(int _x0, int _x1) : x0(_x0), x1(_x1) { }
+
+	bool operator<(const MarkedSpan &other) const { return x0 < other.x0; }
+	bool operator>(const MarkedSpan &other) const { return x0 > other.x0; }
+
+	int x0, x1;
+};
+
+// The traced edges along the tops of the pixels of each row, kept as spans so
+// that long edges take no more room than short ones.  The row being scanned
+// is looked up in increasing x, and spans filed for it while it is being
+// scanned go into a heap, as with the crossings.
+class MarkedEdges {
+public:
+	explicit MarkedEdges(int h) : rows(h), cur_y(-1), cur_idx(0) { }
+
+	void add(int y, int x0, int x1) {
+		// the bottom edge of the grid is never looked up
+		if(y >= int(rows.size())) return;
+		if(y == cur_y) {
+			cur_row.push(MarkedSpan(x0, x1));
+		} else {
+			rows[y].push_back(MarkedSpan(x0, x1));
+		}
+	}
+
+	void start_row(int y) {
+		if(cur_y >= 0) std::vector<MarkedSpan>().swap(rows[cur_y]);
+		while(!cur_row.empty()) cur_row.pop();
+		cur_y = y;
+		cur_idx = 0;
+		std::sort(rows[y].begin(), rows[y].end());
+	}
+
+	// x must not go down between calls for the same row
+	bool contains(int x) {
+		const std::vector<MarkedSpan> &spans = rows[cur_y];
+		while(cur_idx < spans.size() && spans[cur_idx].x1 <= x) cur_idx++;
+		if(cur_idx < spans.size() && spans[cur_idx].x0 <= x) return true;
+		while(!cur_row.empty() && cur_row.top().x1 <= x) cur_row.pop();
+		return !cur_row.empty() && cur_row.top().x0 <= x;
+	}
+
+private:
+	std::vector<std::vector<MarkedSpan> > rows;
+	int cur_y;
+	size_t cur_idx;
+	std::priority_queue<MarkedSpan, std::vector<MarkedSpan>,
+		std::greater<MarkedSpan> > cur_row;
+};
+
+template <typename Classes>
+class ClassTracer {
+public:
+	ClassTracer(const Classes &_classes, size_t _w, size_t _h,
+		int64_t _min_area, bool _no_donuts, bool two_sided_marks);
+
+	std::vector<Mpoly> trace(bool show_progress=true);
+
+private:
+	pixquad_t get_quad(int x, int y, int cls, bool select_class) const {
+		// 1 2
+		// 8 4
+		pixquad_t quad =
+			(classes.class_at(x-1, y-1) == cls ? 1 : 0) +
+			(classes.class_at(x  , y-1) == cls ? 2 : 0) +
+			(classes.class_at(x  , y  ) == cls ? 4 : 0) +
+			(classes.class_at(x-1, y  ) == cls ? 8 : 0);
+		if(!select_class) quad ^= 0xf;
+		return quad;
+	}
+
+	// Each horizontal edge is the boundary of two classes, the ones above and
+	// below.  These record whether a ring of the class below (resp. above) has
+	// been traced along the top edge of pixel (x,y), for y the row being
+	// scanned.  If only one class is wanted, there is only one class per edge
+	// to keep track of and so only marked_below is used.
+	bool is_marked(int x, bool for_below) {
+		return (for_below || !two_sided_marks) ?
+			marked_below.contains(x) : marked_above.contains(x);
+	}
+
+	// Marks the top edges of pixels x0 <= x < x1 of row y, which all have the
+	// same class.
+	void mark_edge(int cls, int x0, int x1, int y) {
+		if(!two_sided_marks || classes.class_at(x0, y) == cls) {
+			marked_below.add(y, x0, x1);
+		} else {
+			marked_above.add(y, x0, x1);
+		}
+	}
+
+	void new_ring(int cls, bool is_hole, int x, int y);
+	void trace_ring(size_t ring_id, int initial_x, int initial_y);
+	void add_crossing(size_t ring_id, int x, int y);
+	void toggle(size_t ring_id);
+	void collect_output(size_t top_ring_id, Mpoly &out_poly);
+
+	const Classes &classes;
+	const int w, h;
+	const int64_t min_area;
+	const bool no_donuts;
+	const bool two_sided_marks;
+
+	std::vector<ClassRing> rings;
+	// rings of each class containing the current pixel, innermost last
+	std::vector<std::vector<size_t> > stacks;
+	// output rings of each class that are not inside of another
+	std::vector<std::vector<size_t> > top_level;
+
+	MarkedEdges marked_below, marked_above;
+
+	std::vector<std::vector<RingCrossing> > crossings;
+	// crossings filed for the row being scanned, while it is being scanned
+	std::priority_queue<RingCrossing, std::vector<RingCrossing>,
+		std::greater<RingCrossing> > cur_row_crossings;
+	int cur_y;
+};
+
+template <typename Classes>
+ClassTracer<Classes>::ClassTracer(const Classes &_classes, size_t _w, size_t _h,
+	int64_t _min_area, bool _no_donuts, bool _two_sided_marks
+) :
+	classes(_classes), w(_w), h(_h),
+	min_area(_min_area), no_donuts(_no_donuts), two_sided_marks(_two_sided_marks),
+	stacks(_classes.num_classes()), top_level(_classes.num_classes()),
+	marked_below(_h),
+	marked_above(_two_sided_marks ? _h : 0),
+	crossings(_h), cur_y(-1)
+{ }
+
+template <typename Classes>
+void ClassTracer<Classes>::add_crossing(size_t ring_id, int x, int y) {
+	if(y == cur_y) {
+		cur_row_crossings.push(RingCrossing(x, ring_id));
+	} else {
+		crossings[y].push_back(RingCrossing(x, ring_id));
+	}
 }
 
-static inline pixquad_t rotate_quad(pixquad_t q, int dir) {
-	return ((q + (q<<4)) >> dir) & 0xf;
+template <typename Classes>
+void ClassTracer<Classes>::toggle(size_t ring_id) {
+	ClassRing &r = rings[ring_id];
+	std::vector<size_t> &stack = stacks[r.cls];
+	if(r.on_stack) {
+		// this is nearly always the top of the stack, except where a ring
+		// is left and another entered at the same edge
+		for(size_t i=stack.size(); i; i--) {
+			if(stack[i-1] == ring_id) {
+				stack.erase(stack.begin() + (i-1));
+				break;
+			}
+		}
+	} else {
+		stack.push_back(ring_id);
+	}
+	r.on_stack = !r.on_stack;
 }
 
-static Ring trace_single_mpoly(const BitGrid &mask, size_t w, size_t h,
-int initial_x, int initial_y, bool select_color) {
-	//printf("trace_single_mpoly enter (%d,%d)\n", initial_x, initial_y);
+// Walks the ring with the selected pixels on its right, starting at the top
+// left corner of a pixel.  Every horizontal edge visited is marked and every
+// vertical edge is filed as a crossing for the rows below.  Horizontal edges
+// are followed a run of pixels at a time, since the ring can't turn before
+// the class of the pixels on one side or the other changes.
+template <typename Classes>
+void ClassTracer<Classes>::trace_ring(size_t ring_id, int initial_x, int initial_y) {
+	const int cls = rings[ring_id].cls;
+	const bool select_class = !rings[ring_id].is_hole;
+	const bool keep_pts = rings[ring_id].output;
+	Ring &ring = rings[ring_id].ring;
 
-	Ring ring;
-	ring.pts.push_back(Vertex(initial_x, initial_y));
+	if(keep_pts) ring.pts.push_back(Vertex(initial_x, initial_y));
 
 	int x = initial_x;
 	int y = initial_y;
-	pixquad_t quad = get_quad(mask, x, y, select_color);
+	pixquad_t quad = get_quad(x, y, cls, select_class);
 	int dir;
 	for(dir=0; dir<4; dir++) {
 		pixquad_t rq = rotate_quad(quad, dir);
@@ -133,18 +529,33 @@ int initial_x, int initial_y, bool select_color) {
 	}
 	if(dir == 4) fatal_error("couldn't choose a starting direction (q=%d)", quad);
 	for(;;) {
-		//printf("xy=(%d,%d)\n", x, y);
-
 		switch(dir) {
-			case DIR_UP: y -= 1; break;
-			case DIR_RT: x += 1; break;
-			case DIR_DN: y += 1; break;
-			case DIR_LF: x -= 1; break;
+			case DIR_UP:
+				y -= 1;
+				// the left edge of the seed pixel is handled by the caller
+				if(!(x == initial_x && y == initial_y)) add_crossing(ring_id, x, y);
+				break;
+			case DIR_RT: {
+				int x1 = classes.span_end(x, y);
+				// stop at the starting point, as a step at a time would have
+				if(y == initial_y && x < initial_x && initial_x < x1) x1 = initial_x;
+				mark_edge(cls, x, x1, y);
+				x = x1;
+				break;
+			}
+			case DIR_DN: add_crossing(ring_id, x, y); y += 1; break;
+			case DIR_LF: {
+				int x0 = classes.span_start(x-1, y);
+				if(y == initial_y && x0 < initial_x && initial_x < x) x0 = initial_x;
+				mark_edge(cls, x0, x, y);
+				x = x0;
+				break;
+			}
 			default: fatal_error("bad direction");
 		}
 		if(x == initial_x && y == initial_y) break;
-		if(x<0 || y<0 || x>(int)w || y>(int)h) fatal_error("fell off edge (%d,%d)", x, y);
-		pixquad_t quad = get_quad(mask, x, y, select_color);
+		if(x<0 || y<0 || x>w || y>h) fatal_error("fell off edge (%d,%d)", x, y);
+		pixquad_t quad = get_quad(x, y, cls, select_class);
 		quad = rotate_quad(quad, dir);
 		if((quad & 12) != 4) fatal_error("tracer was not on the right side of things (%d)", quad);
 		int rot;
@@ -157,115 +568,346 @@ int initial_x, int initial_y, bool select_color) {
 		}
 		dir = (dir + rot + 4) % 4;
 
-		if(rot) {
+		if(rot && keep_pts) {
 			ring.pts.push_back(Vertex(x, y));
 		}
 	}
-
-	return ring;
 }
 
-static int recursive_trace(BitGrid &mask, size_t w, size_t h,
-const Ring &bounding_ring, int depth, Mpoly &out_poly, int parent_id,
-int64_t min_area, bool no_donuts) {
-	//printf("recursive_trace enter: depth=%d\n", depth);
+template <typename Classes>
+void ClassTracer<Classes>::new_ring(int cls, bool is_hole, int x, int y) {
+	// A region is found only if the innermost enclosing ring that gets looked
+	// inside of is an output ring of the opposite kind, and no ring of the
+	// same kind (whose inside would have been passed over, along with this
+	// region) is in the way.  Rings of the opposite kind that are not output
+	// never get looked inside of, so they don't matter.
+	int parent_id = -1;
+	bool output = !is_hole;
+	const std::vector<size_t> &stack = stacks[cls];
+	for(size_t i=stack.size(); i; i--) {
+		const ClassRing &z = rings[stack[i-1]];
+		if(z.blocking || z.is_hole == is_hole) {
+			output = false;
+			break;
+		}
+		if(z.output) {
+			output = true;
+			parent_id = stack[i-1];
+			break;
+		}
+	}
+
+	size_t ring_id = rings.size();
+	rings.push_back(ClassRing(cls, is_hole));
+	rings[ring_id].output = output;
+	trace_ring(ring_id, x, y);
+
+	ClassRing &r = rings[ring_id];
+	if(output && min_area) {
+		Mpoly mp;
+		mp.rings.push_back(r.ring);
+		Bbox bbox = r.ring.getBbox();
+		if(compute_area(get_row_crossings(mp, bbox.min_y, bbox.height())) < min_area) {
+			r.output = false;
+			r.blocking = true;
+			r.ring = Ring();
+		}
+	}
+	if(r.output) {
+		if(parent_id < 0) {
+			top_level[cls].push_back(ring_id);
+			if(no_donuts) r.blocking = true;
+		} else {
+			rings[parent_id].children.push_back(ring_id);
+		}
+	}
 
-	bool select_color = !(depth & 1);
+	// the scan is now just inside the left edge of the seed pixel
+	toggle(ring_id);
+}
 
-	Bbox bounding_bbox = bounding_ring.getBbox();
+// Appends a top level ring and all of its descendants, depth first.
+template <typename Classes>
+void ClassTracer<Classes>::collect_output(size_t top_ring_id, Mpoly &out_poly) {
+	// rings still to be added, along with their parent's index in out_poly
+	std::vector<std::pair<size_t, int> > todo;
+	todo.push_back(std::make_pair(top_ring_id, -1));
+	while(!todo.empty()) {
+		size_t ring_id = todo.back().first;
+		int parent_id = todo.back().second;
+		todo.pop_back();
+
+		ClassRing &r = rings[ring_id];
+		int ring_idx = out_poly.rings.size();
+		out_poly.rings.push_back(Ring());
+		Ring &out_ring = out_poly.rings.back();
+		out_ring.pts.swap(r.ring.pts);
+		out_ring.parent_id = parent_id;
+		out_ring.is_hole = r.is_hole;
+		for(size_t i=r.children.size(); i; i--) {
+			todo.push_back(std::make_pair(r.children[i-1], ring_idx));
+		}
+	}
+}
 
-	Mpoly bounds_mp;
-	bounds_mp.rings.push_back(bounding_ring);
+template <typename Classes>
+std::vector<Mpoly> ClassTracer<Classes>::trace(bool show_progress) {
+	std::vector<Mpoly> out(stacks.size());
 
-	std::vector<row_crossings_t> crossings =
-		get_row_crossings(bounds_mp, bounding_bbox.min_y, bounding_bbox.height());
-	assert(crossings.size() == size_t(bounding_bbox.height()));
-	int skip_this = min_area && (compute_area(crossings) < min_area);
-	int skip_child = skip_this || (depth && no_donuts);
+	// the whole raster is subject to min_area too
+	if(min_area && int64_t(w+1) * int64_t(h+1) < min_area) return out;
 
-	if(!depth) {
-		printf("Tracing: ");
-		GDALTermProgress(0, NULL, NULL);
+	if(show_progress) {
+		status_printf("Tracing: ");
+		term_progress(0);
 	}
 
-	if(!skip_child) {
-		for(int y=bounding_bbox.min_y+1; y<bounding_bbox.max_y; y++) {
-			if(!depth) {
-				GDALTermProgress((double)y/(double)(bounding_bbox.height()-1), NULL, NULL);
+	for(int y=0; y<h; y++) {
+		if(show_progress) term_progress((double)y/(double)h);
+
+		cur_y = y;
+		marked_below.start_row(y);
+		if(two_sided_marks) marked_above.start_row(y);
+		std::vector<RingCrossing> &row_crossings = crossings[y];
+		std::sort(row_crossings.begin(), row_crossings.end());
+		size_t cidx = 0;
+
+		for(int x=0; x<w; x++) {
+			// skip ahead to the next pixel with a crossing on its left
+			// edge or an edge above it
+			int next = w;
+			if(cidx < row_crossings.size()) next = row_crossings[cidx].x;
+			if(!cur_row_crossings.empty()) next = std::min(next, cur_row_crossings.top().x);
+			x = classes.next_edge(y, x, next);
+			if(x >= w) break;
+
+			// step across the left edge of this pixel
+			while(cidx < row_crossings.size() && row_crossings[cidx].x == x) {
+				toggle(row_crossings[cidx++].ring_id);
+			}
+			while(!cur_row_crossings.empty() && cur_row_crossings.top().x == x) {
+				toggle(cur_row_crossings.top().ring_id);
+				cur_row_crossings.pop();
 			}
 
-			// make sure the range (y-1,y)*(x-1,x) is in bounds
-			row_crossings_t cross_both = crossings_intersection(
-				crossings[y-bounding_bbox.min_y-1], crossings[y-bounding_bbox.min_y]);
-			for(size_t cidx=0; cidx<cross_both.size()/2; cidx++) {
-				// make sure the range (y-1,y)*(x-1,x) is in bounds
-				int from = 1+cross_both[cidx*2  ];
-				int to   =   cross_both[cidx*2+1];
-
-				for(int x=from; x<to; x++) {
-					pixquad_t quad = get_quad(mask, x, y, select_color);
-					int is_seed = (quad != 0);
-
-					if(is_seed) {
-						Ring r = trace_single_mpoly(mask, w, h, x, y, select_color);
-
-						r.parent_id = parent_id;
-						r.is_hole = depth % 2;
-						size_t outer_ring_id = out_poly.rings.size();
-						out_poly.rings.push_back(r);
-
-						int was_skip = recursive_trace(
-							mask, w, h, r, depth+1, out_poly, outer_ring_id,
-							min_area, no_donuts);
-
-						if(was_skip) {
-							out_poly.rings.pop_back();
-						}
-					}
-				}
+			int cls = classes.class_at(x, y);
+			int cls_above = classes.class_at(x, y-1);
+			if(cls == cls_above) continue;
+
+			// An untraced edge here is the top-left corner of a region that
+			// hasn't been seen yet: of this pixel's class, or of pixels not
+			// of the class above.
+			if(classes.wanted(cls) && !is_marked(x, true)) {
+				new_ring(cls, false, x, y);
+			}
+			if(cls_above >= 0 && classes.wanted(cls_above) && !is_marked(x, false)) {
+				new_ring(cls_above, true, x, y);
 			}
+
+			// Up to where the class of this row or the one above changes, the
+			// edge is traced by the same rings as here, and nothing crosses
+			// this row, so the rest of the pixels can be skipped.
+			x = classes.span_end(x, y) - 1;
 		}
-	}
 
-	if(depth>0) {
-		// erase this polygon from the raster by filling it with select_color
-		for(int y=bounding_bbox.min_y; y<bounding_bbox.max_y; y++) {
-			const row_crossings_t &r = crossings[y-bounding_bbox.min_y];
-			for(size_t cidx=0; cidx<r.size()/2; cidx++) {
-				int from = r[cidx*2  ];
-				int to   = r[cidx*2+1];
-				for(int x=from; x<=to; x++) {
-					if(x>=0 && y>=0 && size_t(x)<w && size_t(y)<h) {
-						mask.set(x, y, select_color);
-					}
-				}
-			}
+		// the right edge of the raster
+		while(cidx < row_crossings.size()) {
+			toggle(row_crossings[cidx++].ring_id);
+		}
+		while(!cur_row_crossings.empty()) {
+			toggle(cur_row_crossings.top().ring_id);
+			cur_row_crossings.pop();
 		}
+		std::vector<RingCrossing>().swap(row_crossings);
 	}
 
-	if(VERBOSE >= 4) debug_write_mask(mask, w, h);
+	if(show_progress) term_progress(1);
 
-	if(!depth) {
-		GDALTermProgress(1, NULL, NULL);
+	for(size_t cls=0; cls<out.size(); cls++) {
+		BOOST_FOREACH(size_t ring_id, top_level[cls]) {
+			collect_output(ring_id, out[cls]);
+		}
 	}
 
-	return skip_this;
+	return out;
 }
 
-// this function has the side effect of erasing the mask
-Mpoly trace_mask(BitGrid &mask, size_t w, size_t h, int64_t min_area, bool no_donuts) {
+Mpoly trace_mask(const BitGrid &mask, size_t w, size_t h, int64_t min_area, bool no_donuts) {
 	if(VERBOSE >= 4) debug_write_mask(mask, w, h);
 
+	MaskClasses classes(mask);
+	ClassTracer<MaskClasses> tracer(classes, w, h, min_area, no_donuts, false);
 	Mpoly out_poly;
+	out_poly.rings.swap(tracer.trace()[1].rings);
+	status_printf("Trace found %zd rings.\n", out_poly.rings.size());
 
-	recursive_trace(mask, w, h, make_enclosing_ring(w, h), 0, out_poly, -1, min_area, no_donuts);
-	printf("Trace found %zd rings.\n", out_poly.rings.size());
+	return out_poly;
+}
+
+static void read_mask(GDALDatasetH ds, const std::vector<size_t> &band_ids,
+	const NdvDef &ndv_def, DebugPlot *dbuf, int num_threads,
+	BitGrid &mask, RowsReady *rows_ready
+) {
+	read_bitgrid_for_dataset(ds, band_ids, ndv_def, dbuf, num_threads, mask, rows_ready);
+}
 
-	//free(mask_8bit);
+static void read_mask(GDALDatasetH ds, const std::vector<size_t> &band_ids,
+	const NdvDef &ndv_def, DebugPlot *dbuf, int num_threads,
+	RleMask &mask, RowsReady *rows_ready
+) {
+	read_rle_mask_for_dataset(ds, band_ids, ndv_def, dbuf, num_threads, mask, rows_ready);
+}
+
+template <typename Classes>
+static void trace_in_background(ClassTracer<Classes> *tracer, std::vector<Mpoly> *out) {
+	*out = tracer->trace(false);
+}
 
-	//fatal_error("OK");
+// Reads the dataset into the empty mask while tracing it in another thread.
+template <typename Classes, typename Mask>
+static Mpoly trace_while_reading(
+	GDALDatasetH ds, const std::vector<size_t> &band_ids,
+	const NdvDef &ndv_def, DebugPlot *dbuf, int num_threads,
+	int64_t min_area, bool no_donuts, Mask &mask
+) {
+	size_t w = mask.width();
+	size_t h = mask.height();
+
+	RowsReady rows_ready(h);
+	Classes classes(mask, &rows_ready);
+	ClassTracer<Classes> tracer(classes, w, h, min_area, no_donuts, false);
+	std::vector<Mpoly> out;
+	boost::thread trace_thread(trace_in_background<Classes>, &tracer, &out);
+	read_mask(ds, band_ids, ndv_def, dbuf, num_threads, mask, &rows_ready);
+	printf("Finishing trace...\n");
+	trace_thread.join();
+
+	if(VERBOSE >= 4) debug_write_mask(mask, w, h);
+
+	Mpoly out_poly;
+	out_poly.rings.swap(out[1].rings);
+	printf("Trace found %zd rings.\n", out_poly.rings.size());
 
 	return out_poly;
 }
 
+Mpoly trace_dataset_mask(
+	GDALDatasetH ds, const std::vector<size_t> &band_ids,
+	const NdvDef &ndv_def, DebugPlot *dbuf, int num_threads,
+	int64_t min_area, bool no_donuts
+) {
+	size_t w = GDALGetRasterXSize(ds);
+	size_t h = GDALGetRasterYSize(ds);
+
+	// A mask too big to be kept in memory as bits is kept as runs of valid
+	// pixels instead.  That takes much less room than a tiled grid, and
+	// unlike one doesn't mind the tracer jumping around between rows, but
+	// is slower to trace than bits if the mask is noisy.
+	if(BitGrid::would_be_tiled(w, h)) {
+		RleMask mask(w, h);
+		Mpoly out_poly = trace_while_reading<RleClasses>(ds, band_ids, ndv_def, dbuf,
+			num_threads, min_area, no_donuts, mask);
+		if(VERBOSE) printf("mask had %zd runs\n", mask.num_runs());
+		return out_poly;
+	}
+
+	BitGrid mask(w, h);
+	mask.zero();
+	return trace_while_reading<MaskClasses>(ds, band_ids, ndv_def, dbuf,
+		num_threads, min_area, no_donuts, mask);
+}
+
+template <typename T>
+static void trace_class_group(
+	const GridArray<T> *classes, size_t w, size_t h, const std::vector<int> *class_group,
+	int64_t min_area, int group, std::vector<Mpoly> *out
+) {
+	IndexClasses<T> index_classes(*classes, w, h, *class_group, group);
+	ClassTracer<IndexClasses<T> > tracer(index_classes, w, h, min_area, false, true);
+	*out = tracer.trace(group == 0);
+}
+
+// Deals the classes out to num_groups groups, biggest first, each going to
+// the group with the fewest pixels so far.
+static std::vector<int> balance_class_groups(
+	const std::vector<size_t> &class_sizes, int num_groups
+) {
+	std::vector<std::pair<size_t, size_t> > by_size(class_sizes.size());
+	for(size_t cls=0; cls<class_sizes.size(); cls++) {
+		by_size[cls] = std::make_pair(class_sizes[cls], cls);
+	}
+	std::sort(by_size.begin(), by_size.end(), std::greater<std::pair<size_t, size_t> >());
+
+	// (pixels, group), smallest number of pixels on top
+	typedef std::pair<size_t, int> GroupLoad;
+	std::priority_queue<GroupLoad, std::vector<GroupLoad>, std::greater<GroupLoad> > loads;
+	for(int group=0; group<num_groups; group++) {
+		loads.push(GroupLoad(0, group));
+	}
+
+	std::vector<int> class_group(class_sizes.size());
+	for(size_t i=0; i<by_size.size(); i++) {
+		GroupLoad load = loads.top();
+		loads.pop();
+		class_group[by_size[i].second] = load.second;
+		load.first += by_size[i].first;
+		loads.push(load);
+	}
+
+	if(VERBOSE >= 2) {
+		while(!loads.empty()) {
+			printf("group %d: %zd pixels\n", loads.top().second, loads.top().first);
+			loads.pop();
+		}
+	}
+
+	return class_group;
+}
+
+template <typename T>
+std::vector<Mpoly> trace_classes(const GridArray<T> &classes, size_t w, size_t h,
+	const std::vector<size_t> &class_sizes, int64_t min_area, int num_threads
+) {
+	size_t num_classes = class_sizes.size();
+
+	// Classes don't affect each other's rings, so they can be split up
+	// between threads, each doing its own pass over the raster.  Tiled
+	// rasters can't be read from several threads at once.
+	int num_groups = std::min(size_t(std::max(num_threads, 1)), num_classes);
+	if(num_groups < 1 || classes.is_tiled()) num_groups = 1;
+	if(num_groups > 1 && VERBOSE) printf("tracing with %d threads\n", num_groups);
+
+	std::vector<int> class_group;
+	if(num_groups > 1) {
+		class_group = balance_class_groups(class_sizes, num_groups);
+	} else {
+		class_group.resize(num_classes, 0);
+	}
+
+	std::vector<std::vector<Mpoly> > group_out(num_groups);
+	boost::thread_group threads;
+	for(int group=1; group<num_groups; group++) {
+		threads.add_thread(new boost::thread(trace_class_group<T>,
+			&classes, w, h, &class_group, min_area, group, &group_out[group]));
+	}
+	trace_class_group<T>(&classes, w, h, &class_group, min_area, 0, &group_out[0]);
+	threads.join_all();
+
+	std::vector<Mpoly> out(num_classes);
+	size_t num_rings = 0;
+	for(size_t cls=0; cls<out.size(); cls++) {
+		std::vector<Mpoly> &from = group_out[class_group[cls]];
+		if(cls < from.size()) out[cls].rings.swap(from[cls].rings);
+		num_rings += out[cls].rings.size();
+	}
+	printf("Trace found %zd rings.\n", num_rings);
+
+	return out;
+}
+
+template std::vector<Mpoly> trace_classes<uint16_t>(const GridArray<uint16_t> &classes,
+	size_t w, size_t h, const std::vector<size_t> &class_sizes, int64_t min_area, int num_threads);
+template std::vector<Mpoly> trace_classes<uint32_t>(const GridArray<uint32_t> &classes,
+	size_t w, size_t h, const std::vector<size_t> &class_sizes, int64_t min_area, int num_threads);
+
 } // namespace dangdal
@@ -29,13 +29,38 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 #ifndef DANGDAL_MASK_TRACER_H
 #define DANGDAL_MASK_TRACER_H
 
+#include <vector>
+
 #include "mask.h"
 #include "polygon.h"
 
 namespace dangdal {
 
-// this function has the side effect of erasing the mask
-Mpoly trace_mask(BitGrid &mask, size_t w, size_t h, int64_t min_area, bool no_donuts);
+// Traces the outlines of the 'true' regions of the mask, and of the holes in
+// them, and of the islands in those, and so on.  Each ring's parent_id points
+// to the ring it is inside of.  Rings enclosing less than min_area pixels are
+// dropped along with everything inside them.  With no_donuts, only the
+// top-level rings are traced.
+Mpoly trace_mask(const BitGrid &mask, size_t w, size_t h, int64_t min_area, bool no_donuts);
+
+// Reads the mask of valid pixels from the dataset (see get_bitgrid_for_dataset)
+// and traces it like trace_mask does.  The tracing runs in its own thread,
+// working on the rows as soon as they have been read.  A mask that would
+// need to be tiled (see GRID_MEMORY_LIMIT) is kept as an RleMask instead.
+Mpoly trace_dataset_mask(GDALDatasetH ds, const std::vector<size_t> &bandlist,
+	const NdvDef &ndv_def, DebugPlot *dbuf, int num_threads,
+	int64_t min_area, bool no_donuts);
+
+// Traces each class of an indexed raster, giving the same result as calling
+// trace_mask (with no_donuts false) on the mask of each class, but with a
+// single pass over the raster.  Element i of the return value holds the rings
+// of class i, and class_sizes[i] is the number of pixels of class i.  With
+// num_threads > 1, the classes are divided between that many threads, each of
+// which makes its own pass, so that each thread gets about the same number of
+// pixels.  T is either uint16_t or uint32_t.
+template <typename T>
+std::vector<Mpoly> trace_classes(const GridArray<T> &classes, size_t w, size_t h,
+	const std::vector<size_t> &class_sizes, int64_t min_area, int num_threads=1);
 
 } // namespace dangdal
 
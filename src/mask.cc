@@ -30,6 +30,7 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 #include <algorithm>
 
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 
 #include "common.h"
 #include "mask.h"
@@ -40,187 +41,728 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 
 namespace dangdal {
 
-BitGrid get_bitgrid_for_dataset(
-	GDALDatasetH ds, const std::vector<size_t> &band_ids,
-	const NdvDef &ndv_def, DebugPlot *dbuf
+bool COARSE_TO_FINE = false;
+
+// What is known about the pixels of a block before it is read.
+enum BlockContents {
+	BLOCK_UNKNOWN,
+	BLOCK_ALL_VALID,
+	BLOCK_ALL_NDV
+};
+
+// Samples per block, across and down, in the low resolution copy of the
+// dataset used by guess_block_contents.
+static const size_t GUESS_SAMPLES = 4;
+
+// State shared by the threads of get_bitgrid_for_dataset.  The mask is
+// written to either mask or rle_mask, whichever isn't NULL.
+struct BitgridReader {
+	BitgridReader(
+		const std::vector<size_t> &_band_ids, const NdvDef &_ndv_def,
+		DebugPlot *_dbuf, BitGrid *_mask, RleMask *_rle_mask, RowsReady *_rows_ready
+	) :
+		band_ids(_band_ids), ndv_def(_ndv_def), dbuf(_dbuf),
+		mask(_mask), rle_mask(_rle_mask), rows_ready(_rows_ready),
+		w(0), h(0), blocksize_x(0), blocksize_y(0), num_blocks_x(0), num_blocks_y(0),
+		next_block_y(0), blocks_done(0), num_valid(0), num_ndv(0)
+	{ }
+
+	const std::vector<size_t> &band_ids;
+	const NdvDef &ndv_def;
+	DebugPlot *dbuf;
+	BitGrid *mask;
+	RleMask *rle_mask;
+	RowsReady *rows_ready;
+
+	size_t w, h;
+	size_t blocksize_x, blocksize_y;
+	size_t num_blocks_x, num_blocks_y;
+	// BlockContents of each block in row order, or empty if every block is
+	// to be read
+	std::vector<uint8_t> block_contents;
+
+	// protects everything below, and the progress bar
+	boost::mutex lock;
+	size_t next_block_y;
+	size_t blocks_done;
+	size_t num_valid;
+	size_t num_ndv;
+
+	// Held while writing to the debug plot or to a tiled mask, neither of
+	// which can take writes from several threads at once.
+	boost::mutex write_lock;
+};
+
+// Returns BLOCK_ALL_VALID or BLOCK_ALL_NDV if the pixels of a block are all
+// valid or all NDV, and BLOCK_UNKNOWN if they are mixed.
+static uint8_t uniform_block_contents(const std::vector<uint8_t> &block_mask,
+	size_t blocksize_x, size_t bsize_x, size_t bsize_y
 ) {
-	assert(!band_ids.empty());
-
-	size_t w = GDALGetRasterXSize(ds);
-	size_t h = GDALGetRasterYSize(ds);
-	size_t band_count = GDALGetRasterCount(ds);
-	if(VERBOSE) printf("input is %zd x %zd x %zd\n", w, h, band_count);
+	uint8_t first = block_mask[0];
+	for(size_t sub_y=0; sub_y<bsize_y; sub_y++) {
+		const uint8_t *row = &block_mask[sub_y*blocksize_x];
+		for(size_t sub_x=0; sub_x<bsize_x; sub_x++) {
+			if(row[sub_x] != first) return BLOCK_UNKNOWN;
+		}
+	}
+	return first ? BLOCK_ALL_NDV : BLOCK_ALL_VALID;
+}
 
+// Reads rows of blocks from the given dataset handle into the mask, until
+// there are no rows left.  Each row of blocks is handled by a single thread,
+// so threads never write to the same words of an in-memory mask, or to the
+// same rows of an RleMask.
+static void read_block_rows(BitgridReader *rd, GDALDatasetH ds) {
 	std::vector<GDALRasterBandH> bands;
 	std::vector<GDALDataType> datatypes;
-	BOOST_FOREACH(const size_t band_id, band_ids) {
-		if(VERBOSE) printf("opening band %zd\n", band_id);
+	BOOST_FOREACH(const size_t band_id, rd->band_ids) {
 		GDALRasterBandH band = GDALGetRasterBand(ds, band_id);
 		if(!band) fatal_error("Could not open band %zd.", band_id);
 		bands.push_back(band);
-		GDALDataType dt = GDALGetRasterDataType(band);
-		datatypes.push_back(dt);
+		datatypes.push_back(GDALGetRasterDataType(band));
 	}
 
-	int blocksize_x_int, blocksize_y_int;
-	GDALGetBlockSize(bands[0], &blocksize_x_int, &blocksize_y_int);
-	// Out of laziness, I am hoping that images always have the same block size for each band.
-	BOOST_FOREACH(const GDALRasterBandH band, bands) {
-		int bx, by;
-		GDALGetBlockSize(band, &bx, &by);
-		if(bx != blocksize_x_int || by != blocksize_y_int) {
-			fatal_error(
-				"Bands have different block sizes.  Not currently implemented.  Please contact developer");
-		}
-	}
-	size_t blocksize_x = blocksize_x_int;
-	size_t blocksize_y = blocksize_y_int;
+	size_t w = rd->w;
+	size_t h = rd->h;
+	size_t blocksize_x = rd->blocksize_x;
+	size_t blocksize_y = rd->blocksize_y;
 	size_t blocksize_xy = blocksize_x * blocksize_y;
+	DebugPlot *dbuf = rd->dbuf;
+	bool serialize_writes = dbuf || (rd->mask && rd->mask->is_tiled());
 
 	std::vector<std::vector<uint8_t> > band_buf(bands.size());
+	std::vector<const void *> band_p(bands.size());
 	for(size_t i=0; i<bands.size(); i++) {
 		size_t dt_size = GDALGetDataTypeSize(datatypes[i]) / 8;
 		size_t num_bytes = blocksize_xy * dt_size;
 		band_buf[i].resize(num_bytes);
+		band_p[i] = &band_buf[i][0];
 	}
+	boost::shared_ptr<const NdvPredicate> ndv_pred = rd->ndv_def.compile(datatypes);
 
 	std::vector<uint8_t> block_mask(blocksize_xy);
 
-	BitGrid mask(w, h);
-	mask.zero();
-
 	size_t num_valid = 0;
 	size_t num_ndv = 0;
 
-	printf("Reading input...\n");
+	for(;;) {
+		size_t block_y;
+		{
+			boost::mutex::scoped_lock lock(rd->lock);
+			if(rd->next_block_y == rd->num_blocks_y) break;
+			block_y = rd->next_block_y++;
+		}
 
-	size_t num_blocks_x = (w + blocksize_x - 1) / blocksize_x;
-	size_t num_blocks_y = (h + blocksize_y - 1) / blocksize_y;
-	for(size_t block_y=0; block_y<num_blocks_y; block_y++) {
 		size_t boff_y = blocksize_y * block_y;
 		size_t bsize_y = blocksize_y;
 		if(bsize_y + boff_y > h) bsize_y = h - boff_y;
-		for(size_t block_x=0; block_x<num_blocks_x; block_x++) {
+		for(size_t block_x=0; block_x<rd->num_blocks_x; block_x++) {
 			size_t boff_x = blocksize_x * block_x;
 			size_t bsize_x = blocksize_x;
 			if(bsize_x + boff_x > w) bsize_x = w - boff_x;
 
-			double progress =
-				double(
-					boff_y * w +
-					boff_x * bsize_y
-				) / (w * h);
-			GDALTermProgress(progress, NULL, NULL);
-
-			for(size_t band_idx=0; band_idx<bands.size(); band_idx++) {
-				GDALReadBlock(bands[band_idx], block_x, block_y, &band_buf[band_idx][0]);
+			uint8_t contents = rd->block_contents.empty() ? uint8_t(BLOCK_UNKNOWN) :
+				rd->block_contents[block_y * rd->num_blocks_x + block_x];
+			if(contents == BLOCK_UNKNOWN) {
+				for(size_t band_idx=0; band_idx<bands.size(); band_idx++) {
+					GDALReadBlock(bands[band_idx], block_x, block_y, &band_buf[band_idx][0]);
+				}
+				ndv_pred->getNdvMask(band_p, &block_mask[0], blocksize_xy);
+				contents = uniform_block_contents(block_mask, blocksize_x, bsize_x, bsize_y);
+			} else if(dbuf) {
+				std::fill(block_mask.begin(), block_mask.end(), contents == BLOCK_ALL_NDV);
+				// the debug plot shows skipped blocks as flat
+				for(size_t band_idx=0; band_idx<bands.size(); band_idx++) {
+					std::fill(band_buf[band_idx].begin(), band_buf[band_idx].end(), 0);
+				}
 			}
-			ndv_def.getNdvMask(band_buf, datatypes, &block_mask[0], blocksize_xy);
-
-			for(size_t sub_y=0; sub_y<bsize_y; sub_y++) {
-				size_t y = sub_y + boff_y;
-				bool is_dbuf_stride_y = dbuf && ((y % dbuf->stride_y) == 0);
-				for(size_t sub_x=0; sub_x<bsize_x; sub_x++) {
-					size_t x = sub_x + boff_x;
-					bool is_dbuf_stride = is_dbuf_stride_y && ((sub_x % dbuf->stride_x) == 0);
-
-					bool is_ndv = block_mask[sub_y*blocksize_x + sub_x];
-					mask.set(x, y, !is_ndv);
-					if(is_ndv) {
-						num_ndv++;
-					} else {
-						num_valid++;
+
+			if(serialize_writes) rd->write_lock.lock();
+			if(contents != BLOCK_UNKNOWN && !dbuf) {
+				// Blocks that are all one thing, as the inside and outside of
+				// the valid region mostly are, are filled in a row at a time.
+				if(contents == BLOCK_ALL_VALID) {
+					for(size_t y=boff_y; y<boff_y+bsize_y; y++) {
+						if(rd->mask) rd->mask->fill_span(y, boff_x, boff_x+bsize_x, true);
+						if(rd->rle_mask) rd->rle_mask->add_run(y, boff_x, boff_x+bsize_x);
 					}
+					num_valid += bsize_x * bsize_y;
+				} else {
+					num_ndv += bsize_x * bsize_y;
+				}
+			} else {
+				for(size_t sub_y=0; sub_y<bsize_y; sub_y++) {
+					size_t y = sub_y + boff_y;
+					bool is_dbuf_stride_y = dbuf && ((y % dbuf->stride_y) == 0);
+					for(size_t sub_x=0; sub_x<bsize_x; sub_x++) {
+						size_t x = sub_x + boff_x;
+						bool is_dbuf_stride = is_dbuf_stride_y && ((sub_x % dbuf->stride_x) == 0);
+
+						bool is_ndv = block_mask[sub_y*blocksize_x + sub_x];
+						if(is_ndv) {
+							num_ndv++;
+						} else {
+							if(rd->mask) rd->mask->set(x, y, true);
+							num_valid++;
+						}
 
-					if(is_dbuf_stride) {
-						uint8_t val[3] = { 0, 0, 0 };
-						if(!is_ndv) {
-							for(size_t rgb_idx=0; rgb_idx<3; rgb_idx++) {
-								size_t band_idx = std::min(rgb_idx, bands.size()-1);
-								double dbl_val = gdal_scalar_to_double(
-									&band_buf[band_idx][sub_y*blocksize_x + sub_x], datatypes[band_idx]);
-								// valid pixels have texture of the image, but with a cyanish hue
-								if(rgb_idx==0) {
-									val[rgb_idx] = std::max(0.0, std::min(127.0, dbl_val*0.5));
-								} else {
-									val[rgb_idx] = std::max(64.0, std::min(191.0, dbl_val*0.5+64));
+						if(is_dbuf_stride) {
+							uint8_t val[3] = { 0, 0, 0 };
+							if(!is_ndv) {
+								for(size_t rgb_idx=0; rgb_idx<3; rgb_idx++) {
+									size_t band_idx = std::min(rgb_idx, bands.size()-1);
+									double dbl_val = gdal_scalar_to_double(
+										&band_buf[band_idx][sub_y*blocksize_x + sub_x], datatypes[band_idx]);
+									// valid pixels have texture of the image, but with a cyanish hue
+									if(rgb_idx==0) {
+										val[rgb_idx] = std::max(0.0, std::min(127.0, dbl_val*0.5));
+									} else {
+										val[rgb_idx] = std::max(64.0, std::min(191.0, dbl_val*0.5+64));
+									}
 								}
 							}
+							dbuf->plotPoint(x, y, val[0], val[1], val[2]);
+
+							// Old color scheme:
+							//int val = gdal_scalar_to_int32(
+							//	&band_buf[0][sub_y*blocksize_x + sub_x], datatypes[0]);
+							//int db_v = 50 + val/3;
+							//if(db_v < 50) db_v = 50;
+							//if(db_v > 254) db_v = 254;
+							//uint8_t r = (uint8_t)(db_v*.75);
+							//dbuf->plotPoint(x, y, r, (uint8_t)db_v, (uint8_t)db_v);
+						}
+					}
+
+					if(rd->rle_mask) {
+						// blocks are read left to right, so runs get appended in order
+						const uint8_t *row_ndv = &block_mask[sub_y*blocksize_x];
+						size_t sub_x = 0;
+						while(sub_x < bsize_x) {
+							while(sub_x < bsize_x && row_ndv[sub_x]) sub_x++;
+							size_t run_start = sub_x;
+							while(sub_x < bsize_x && !row_ndv[sub_x]) sub_x++;
+							if(sub_x > run_start) {
+								rd->rle_mask->add_run(y, boff_x + run_start, boff_x + sub_x);
+							}
 						}
-						dbuf->plotPoint(x, y, val[0], val[1], val[2]);
-
-						// Old color scheme:
-						//int val = gdal_scalar_to_int32(
-						//	&band_buf[0][sub_y*blocksize_x + sub_x], datatypes[0]);
-						//int db_v = 50 + val/3;
-						//if(db_v < 50) db_v = 50;
-						//if(db_v > 254) db_v = 254;
-						//uint8_t r = (uint8_t)(db_v*.75);
-						//dbuf->plotPoint(x, y, r, (uint8_t)db_v, (uint8_t)db_v);
 					}
 				}
 			}
+			if(serialize_writes) rd->write_lock.unlock();
+
+			{
+				boost::mutex::scoped_lock lock(rd->lock);
+				rd->blocks_done++;
+				GDALTermProgress(
+					double(rd->blocks_done) / (rd->num_blocks_x * rd->num_blocks_y),
+					NULL, NULL);
+			}
 		}
+
+		if(rd->rows_ready) rd->rows_ready->set_ready(boff_y, boff_y + bsize_y);
 	}
 
-	GDALTermProgress(1, NULL, NULL);
+	boost::mutex::scoped_lock lock(rd->lock);
+	rd->num_valid += num_valid;
+	rd->num_ndv += num_ndv;
+}
 
-	printf("Found %zd valid and %zd NDV pixels.\n", num_valid, num_ndv);
+void RowsReady::set_ready(int y0, int y1) {
+	boost::mutex::scoped_lock l(lock);
+	for(int y=y0; y<y1; y++) done[y] = true;
+	int old_ready = num_ready;
+	while(num_ready < int(done.size()) && done[num_ready]) num_ready++;
+	if(num_ready != old_ready) cond.notify_all();
+}
+
+int RowsReady::wait_for(int y) {
+	boost::mutex::scoped_lock l(lock);
+	while(num_ready <= y) cond.wait(l);
+	return num_ready;
+}
 
+BitGrid get_bitgrid_for_dataset(
+	GDALDatasetH ds, const std::vector<size_t> &band_ids,
+	const NdvDef &ndv_def, DebugPlot *dbuf, int num_threads
+) {
+	BitGrid mask(GDALGetRasterXSize(ds), GDALGetRasterYSize(ds));
+	mask.zero();
+	read_bitgrid_for_dataset(ds, band_ids, ndv_def, dbuf, num_threads, mask, NULL);
 	return mask;
 }
 
-void BitGrid::erode() { // FIXME - untested
-	bool *rowu = new bool[w];
-	bool *rowm = new bool[w];
-	bool *rowl = new bool[w];
-	for(int i=0; i<w; i++) {
-		rowm[i] = 0;
-		rowl[i] = get(i, 0, 0);
+// Guesses which blocks are all valid or all NDV from a copy of the dataset
+// shrunk so that each block is GUESS_SAMPLES pixels across, which GDAL reads
+// from the overviews.  A block is only taken to be all one thing if the blocks
+// around it look to be too, so that an edge of the valid region can't slip
+// between the samples unnoticed, but features smaller than the samples can be
+// missed.  Without overviews GDAL would have to decode every block to make the
+// shrunk copy, and the mixed blocks would then be read again, so nothing is
+// guessed.
+static void guess_block_contents(BitgridReader &rd, const std::vector<GDALRasterBandH> &bands) {
+	BOOST_FOREACH(const GDALRasterBandH band, bands) {
+		if(GDALGetOverviewCount(band) == 0) {
+			if(VERBOSE) printf("input has no overviews, reading all blocks\n");
+			return;
+		}
 	}
 
-	for(int y=0; y<h; y++) {
-		bool *tmp = rowu;
-		rowu = rowm; rowm = rowl; rowl = tmp;
-		for(int i=0; i<w; i++) {
-			rowl[i] = get(i, y+1, 0);
+	size_t sample_w = std::min(rd.w, rd.num_blocks_x * GUESS_SAMPLES);
+	size_t sample_h = std::min(rd.h, rd.num_blocks_y * GUESS_SAMPLES);
+	size_t num_samples = sample_w * sample_h;
+
+	std::vector<GDALDataType> datatypes;
+	std::vector<std::vector<uint8_t> > band_buf(bands.size());
+	std::vector<const void *> band_p(bands.size());
+	for(size_t i=0; i<bands.size(); i++) {
+		GDALDataType dt = GDALGetRasterDataType(bands[i]);
+		datatypes.push_back(dt);
+		band_buf[i].resize(num_samples * (GDALGetDataTypeSize(dt) / 8));
+		band_p[i] = &band_buf[i][0];
+		CPLErr err = GDALRasterIO(bands[i], GF_Read, 0, 0, rd.w, rd.h,
+			&band_buf[i][0], sample_w, sample_h, dt, 0, 0);
+		if(err != CE_None) {
+			if(VERBOSE) printf("could not read low resolution copy, reading all blocks\n");
+			return;
+		}
+	}
+	std::vector<uint8_t> sample_ndv(num_samples);
+	rd.ndv_def.compile(datatypes)->getNdvMask(band_p, &sample_ndv[0], num_samples);
+
+	// bit 0 is set if a valid sample is in the block, bit 1 for an NDV one
+	std::vector<uint8_t> seen(rd.num_blocks_x * rd.num_blocks_y, 0);
+	for(size_t sy=0; sy<sample_h; sy++) {
+		// the block holding the center of the sample
+		size_t block_y = ((2*sy+1) * rd.h / (2*sample_h)) / rd.blocksize_y;
+		for(size_t sx=0; sx<sample_w; sx++) {
+			size_t block_x = ((2*sx+1) * rd.w / (2*sample_w)) / rd.blocksize_x;
+			seen[block_y * rd.num_blocks_x + block_x] |= sample_ndv[sy*sample_w + sx] ? 2 : 1;
+		}
+	}
+
+	// blocks already known about are left alone
+	if(rd.block_contents.empty()) rd.block_contents.assign(seen.size(), BLOCK_UNKNOWN);
+	size_t num_skipped = 0;
+	for(size_t by=0; by<rd.num_blocks_y; by++) {
+		for(size_t bx=0; bx<rd.num_blocks_x; bx++) {
+			if(!seen[by * rd.num_blocks_x + bx]) continue;
+			uint8_t &contents = rd.block_contents[by * rd.num_blocks_x + bx];
+			if(contents != BLOCK_UNKNOWN) continue;
+			uint8_t around = 0;
+			for(size_t ny=(by ? by-1 : 0); ny<=by+1 && ny<rd.num_blocks_y; ny++) {
+				for(size_t nx=(bx ? bx-1 : 0); nx<=bx+1 && nx<rd.num_blocks_x; nx++) {
+					around |= seen[ny * rd.num_blocks_x + nx];
+				}
+			}
+			if(around == 1) contents = BLOCK_ALL_VALID;
+			if(around == 2) contents = BLOCK_ALL_NDV;
+			if(contents != BLOCK_UNKNOWN) num_skipped++;
+		}
+	}
+	if(VERBOSE) printf("skipping %zd of %zd blocks\n", num_skipped, seen.size());
+}
+
+// Finds the blocks that are known to be all valid or all NDV without reading
+// them: all of them if there is no NDV and no band can hold NaN, and otherwise
+// those that are missing from every band of a sparse file (these read as the
+// nodata value, or zero).
+static void summarize_blocks(BitgridReader &rd, const std::vector<GDALRasterBandH> &bands) {
+	size_t num_blocks = rd.num_blocks_x * rd.num_blocks_y;
+	if(rd.ndv_def.empty()) {
+		bool can_be_nan = false;
+		BOOST_FOREACH(const GDALRasterBandH band, bands) {
+			if(datatype_can_be_nan(GDALGetRasterDataType(band))) can_be_nan = true;
+		}
+		if(!can_be_nan) {
+			rd.block_contents.assign(num_blocks,
+				rd.ndv_def.isInvert() ? BLOCK_ALL_NDV : BLOCK_ALL_VALID);
+			return;
+		}
+	}
+
+#ifdef GDAL_DATA_COVERAGE_STATUS_EMPTY
+	BOOST_FOREACH(const GDALRasterBandH band, bands) {
+		int status = GDALGetDataCoverageStatus(band, 0, 0, rd.w, rd.h, 0, NULL);
+		if(!(status & GDAL_DATA_COVERAGE_STATUS_EMPTY)) return;
+	}
+
+	std::vector<GDALDataType> datatypes;
+	std::vector<std::vector<uint8_t> > fill_val(bands.size());
+	std::vector<const void *> band_p(bands.size());
+	for(size_t i=0; i<bands.size(); i++) {
+		GDALDataType dt = GDALGetRasterDataType(bands[i]);
+		datatypes.push_back(dt);
+		int has_ndv;
+		double val = GDALGetRasterNoDataValue(bands[i], &has_ndv);
+		if(!has_ndv) val = 0;
+		fill_val[i].resize(GDALGetDataTypeSize(dt) / 8);
+		GDALCopyWords(&val, GDT_Float64, 0, &fill_val[i][0], dt, 0, 1);
+		band_p[i] = &fill_val[i][0];
+	}
+	uint8_t fill_is_ndv;
+	rd.ndv_def.compile(datatypes)->getNdvMask(band_p, &fill_is_ndv, 1);
+
+	rd.block_contents.assign(num_blocks, BLOCK_UNKNOWN);
+	size_t num_missing = 0;
+	for(size_t by=0; by<rd.num_blocks_y; by++) {
+		size_t boff_y = rd.blocksize_y * by;
+		size_t bsize_y = std::min(rd.blocksize_y, rd.h - boff_y);
+		for(size_t bx=0; bx<rd.num_blocks_x; bx++) {
+			size_t boff_x = rd.blocksize_x * bx;
+			size_t bsize_x = std::min(rd.blocksize_x, rd.w - boff_x);
+			bool missing = true;
+			BOOST_FOREACH(const GDALRasterBandH band, bands) {
+				int status = GDALGetDataCoverageStatus(band,
+					boff_x, boff_y, bsize_x, bsize_y, 0, NULL);
+				if(status != GDAL_DATA_COVERAGE_STATUS_EMPTY) {
+					missing = false;
+					break;
+				}
+			}
+			if(missing) {
+				rd.block_contents[by * rd.num_blocks_x + bx] =
+					fill_is_ndv ? BLOCK_ALL_NDV : BLOCK_ALL_VALID;
+				num_missing++;
+			}
+		}
+	}
+	if(VERBOSE) printf("%zd of %zd blocks are missing from the file\n", num_missing, num_blocks);
+#endif
+}
+
+static void read_mask_for_dataset(
+	GDALDatasetH ds, const std::vector<size_t> &band_ids,
+	const NdvDef &ndv_def, DebugPlot *dbuf, int num_threads,
+	BitGrid *mask, RleMask *rle_mask, RowsReady *rows_ready
+) {
+	assert(!band_ids.empty());
+
+	size_t w = GDALGetRasterXSize(ds);
+	size_t h = GDALGetRasterYSize(ds);
+	size_t band_count = GDALGetRasterCount(ds);
+	if(VERBOSE) printf("input is %zd x %zd x %zd\n", w, h, band_count);
+
+	std::vector<GDALRasterBandH> bands;
+	BOOST_FOREACH(const size_t band_id, band_ids) {
+		if(VERBOSE) printf("opening band %zd\n", band_id);
+		GDALRasterBandH band = GDALGetRasterBand(ds, band_id);
+		if(!band) fatal_error("Could not open band %zd.", band_id);
+		bands.push_back(band);
+	}
+
+	int blocksize_x_int, blocksize_y_int;
+	GDALGetBlockSize(bands[0], &blocksize_x_int, &blocksize_y_int);
+	// Out of laziness, I am hoping that images always have the same block size for each band.
+	BOOST_FOREACH(const GDALRasterBandH band, bands) {
+		int bx, by;
+		GDALGetBlockSize(band, &bx, &by);
+		if(bx != blocksize_x_int || by != blocksize_y_int) {
+			fatal_error(
+				"Bands have different block sizes.  Not currently implemented.  Please contact developer");
+		}
+	}
+
+	BitgridReader rd(band_ids, ndv_def, dbuf, mask, rle_mask, rows_ready);
+	rd.w = w;
+	rd.h = h;
+	rd.blocksize_x = blocksize_x_int;
+	rd.blocksize_y = blocksize_y_int;
+	rd.num_blocks_x = (w + rd.blocksize_x - 1) / rd.blocksize_x;
+	rd.num_blocks_y = (h + rd.blocksize_y - 1) / rd.blocksize_y;
+
+	// The debug plot shows the pixel values, so needs every block read.
+	if(!dbuf) summarize_blocks(rd, bands);
+	if(COARSE_TO_FINE && !rd.ndv_def.empty()) guess_block_contents(rd, bands);
+
+	printf("Reading input...\n");
+	GDALTermProgress(0, NULL, NULL);
+
+	// Each extra thread reads through its own handle to the dataset, since
+	// GDAL handles can't be shared between threads.
+	std::vector<GDALDatasetH> extra_ds;
+	size_t max_threads = std::min(size_t(std::max(num_threads, 1)), rd.num_blocks_y);
+	while(extra_ds.size()+1 < max_threads) {
+		GDALDatasetH thread_ds = GDALOpen(GDALGetDescription(ds), GA_ReadOnly);
+		if(!thread_ds) {
+			if(VERBOSE) printf("could not reopen dataset, using %zd threads\n",
+				extra_ds.size()+1);
+			break;
+		}
+		extra_ds.push_back(thread_ds);
+	}
+
+	boost::thread_group threads;
+	BOOST_FOREACH(GDALDatasetH thread_ds, extra_ds) {
+		threads.add_thread(new boost::thread(read_block_rows, &rd, thread_ds));
+	}
+	read_block_rows(&rd, ds);
+	threads.join_all();
+
+	BOOST_FOREACH(GDALDatasetH thread_ds, extra_ds) {
+		GDALClose(thread_ds);
+	}
+
+	GDALTermProgress(1, NULL, NULL);
+
+	printf("Found %zd valid and %zd NDV pixels.\n", rd.num_valid, rd.num_ndv);
+}
+
+void read_bitgrid_for_dataset(
+	GDALDatasetH ds, const std::vector<size_t> &band_ids,
+	const NdvDef &ndv_def, DebugPlot *dbuf, int num_threads,
+	BitGrid &mask, RowsReady *rows_ready
+) {
+	assert(mask.width() == GDALGetRasterXSize(ds) && mask.height() == GDALGetRasterYSize(ds));
+	read_mask_for_dataset(ds, band_ids, ndv_def, dbuf, num_threads, &mask, NULL, rows_ready);
+}
+
+void read_rle_mask_for_dataset(
+	GDALDatasetH ds, const std::vector<size_t> &band_ids,
+	const NdvDef &ndv_def, DebugPlot *dbuf, int num_threads,
+	RleMask &mask, RowsReady *rows_ready
+) {
+	assert(mask.width() == GDALGetRasterXSize(ds) && mask.height() == GDALGetRasterYSize(ds));
+	read_mask_for_dataset(ds, band_ids, ndv_def, dbuf, num_threads, NULL, &mask, rows_ready);
+}
+
+static inline int popcount64(uint64_t v) {
+#ifdef __GNUC__
+	return __builtin_popcountll(v);
+#else
+	v = v - ((v >> 1) & 0x5555555555555555ULL);
+	v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+	v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return int((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// index of the lowest set bit, v must be nonzero
+static inline int lowest_bit64(uint64_t v) {
+#ifdef __GNUC__
+	return __builtin_ctzll(v);
+#else
+	int n = 0;
+	while(!(v & 1)) { v >>= 1; n++; }
+	return n;
+#endif
+}
+
+// index of the highest set bit, v must be nonzero
+static inline int highest_bit64(uint64_t v) {
+#ifdef __GNUC__
+	return 63 - __builtin_clzll(v);
+#else
+	int n = 63;
+	while(!(v >> 63)) { v <<= 1; n--; }
+	return n;
+#endif
+}
+
+void BitGrid::fill_span(int y, int x0, int x1, bool val) {
+	assert(y>=0 && y<h && x0>=0 && x1<=w);
+	if(x0 >= x1) return;
+
+	word_t *p = row(y);
+	int i0 = x0 / WORD_BITS;
+	int i1 = (x1-1) / WORD_BITS;
+	word_t m0 = ~word_t(0) << (x0 % WORD_BITS);
+	word_t m1 = ~word_t(0) >> (WORD_BITS - 1 - (x1-1) % WORD_BITS);
+	if(i0 == i1) m0 &= m1;
+
+	if(val) {
+		p[i0] |= m0;
+		for(int i=i0+1; i<i1; i++) p[i] = ~word_t(0);
+		if(i1 > i0) p[i1] |= m1;
+	} else {
+		p[i0] &= ~m0;
+		for(int i=i0+1; i<i1; i++) p[i] = 0;
+		if(i1 > i0) p[i1] &= ~m1;
+	}
+}
+
+int BitGrid::find_next(int y, int x0, int x1, bool val) const {
+	assert(y>=0 && y<h && x0>=0 && x1<=w);
+	if(x0 >= x1) return x1;
+
+	const word_t *p = row(y);
+	// searching for 'false' is the same as searching the complement for 'true'
+	word_t flip = val ? 0 : ~word_t(0);
+	int i = x0 / WORD_BITS;
+	int last = (x1-1) / WORD_BITS;
+	word_t word = (p[i] ^ flip) & (~word_t(0) << (x0 % WORD_BITS));
+	for(;;) {
+		if(word) {
+			int x = i*WORD_BITS + lowest_bit64(word);
+			return x < x1 ? x : x1;
 		}
+		if(++i > last) return x1;
+		word = p[i] ^ flip;
+	}
+}
 
-		bool ul = 0, um = rowu[0];
-		bool ml = 0, mm = rowm[0];
-		bool ll = 0, lm = rowl[0];
+int BitGrid::find_prev(int y, int x0, int x1, bool val) const {
+	assert(y>=0 && y<h && x0>=0 && x1<=w);
+	if(x0 >= x1) return x0-1;
+
+	const word_t *p = row(y);
+	word_t flip = val ? 0 : ~word_t(0);
+	int i = (x1-1) / WORD_BITS;
+	int first = x0 / WORD_BITS;
+	word_t word = (p[i] ^ flip) & (~word_t(0) >> (WORD_BITS - 1 - (x1-1) % WORD_BITS));
+	for(;;) {
+		if(word) {
+			int x = i*WORD_BITS + highest_bit64(word);
+			return x >= x0 ? x : x0-1;
+		}
+		if(--i < first) return x0-1;
+		word = p[i] ^ flip;
+	}
+}
 
-		for(int x=0; x<w; x++) {
-			bool ur = (x+1<w) ? rowu[x+1] : 0;
-			bool mr = (x+1<w) ? rowm[x+1] : 0;
-			bool lr = (x+1<w) ? rowl[x+1] : 0;
+int BitGrid::find_next_change(int y, int x0, int x1) const {
+	assert(y>=1 && y<h && x0>=0 && x1<=w);
+	if(x0 >= x1) return x1;
+
+	int i = x0 / WORD_BITS;
+	int last = (x1-1) / WORD_BITS;
+	// For tiled grids, the two row pointers stay valid together.
+	const word_t *above = row(y-1);
+	const word_t *p = row(y);
+	word_t word = (p[i] ^ above[i]) & (~word_t(0) << (x0 % WORD_BITS));
+	for(;;) {
+		if(word) {
+			int x = i*WORD_BITS + lowest_bit64(word);
+			return x < x1 ? x : x1;
+		}
+		if(++i > last) return x1;
+		word = p[i] ^ above[i];
+	}
+}
 
-			// remove pixels that don't have two consecutive filled neighbors
-			if(!(
-				(ul&&um) || (um&&ur) || (ur&&mr) || (mr&&lr) ||
-				(lr&&lm) || (lm&&ll) || (ll&&ml) || (ml&&ul)
-			)) set(x, y, false);
+int RleMask::find_next_change(int y, int x0, int x1) const {
+	assert(y>=1 && y<h && x0>=0 && x1<=w);
+	if(x0 >= x1) return x1;
+
+	// Step through the run ends of both rows.  The pixels of a row are
+	// 'true' wherever an odd number of its run ends have been passed.
+	const runs_t &ra = rows[y-1];
+	const runs_t &rb = rows[y];
+	size_t ia = std::upper_bound(ra.begin(), ra.end(), x0) - ra.begin();
+	size_t ib = std::upper_bound(rb.begin(), rb.end(), x0) - rb.begin();
+	int x = x0;
+	for(;;) {
+		if((ia ^ ib) & 1) return x;
+		int next_a = ia < ra.size() ? ra[ia] : w;
+		int next_b = ib < rb.size() ? rb[ib] : w;
+		x = std::min(next_a, next_b);
+		if(x >= x1) return x1;
+		if(next_a == x) ia++;
+		if(next_b == x) ib++;
+	}
+}
 
-			ul=um; ml=mm; ll=lm;
-			um=ur; mm=mr; lm=lr;
+size_t RleMask::num_runs() const {
+	size_t n = 0;
+	for(int y=0; y<h; y++) n += rows[y].size() / 2;
+	return n;
+}
+
+size_t BitGrid::count() const {
+	size_t cnt = 0;
+	for(int y=0; y<h; y++) {
+		const word_t *p = row(y);
+		for(int i=0; i<words_per_row; i++) {
+			cnt += popcount64(p[i]);
 		}
 	}
+	return cnt;
+}
 
-	delete[] rowu;
-	delete[] rowm;
-	delete[] rowl;
+void BitGrid::invert() {
+	if(!words_per_row) return;
+	word_t tail = tail_mask();
+	for(int y=0; y<h; y++) {
+		word_t *p = row(y);
+		for(int i=0; i<words_per_row; i++) {
+			p[i] = ~p[i];
+		}
+		p[words_per_row-1] &= tail;
+	}
+}
+
+// Removes pixels that don't have two consecutive filled neighbors, going
+// around the ring of eight neighbors.  All of the neighbors of a row are
+// computed at once by shifting the words of the rows above and below.
+void BitGrid::erode() {
+	if(!words_per_row) return;
+
+	// Unmodified copies of the previous and current row.  The row below has
+	// not been touched yet, so it is read directly from the grid.
+	const BitGrid &self = *this;
+	std::vector<word_t> rowu(words_per_row, 0);
+	std::vector<word_t> rowm(words_per_row, 0);
+	std::vector<word_t> zeros(words_per_row, 0);
+
+	for(int y=0; y<h; y++) {
+		std::swap(rowu, rowm);
+		word_t *p = row(y);
+		std::copy(p, p+words_per_row, rowm.begin());
+		const word_t *rl = (y+1<h) ? self.row(y+1) : &zeros[0];
+
+		for(int i=0; i<words_per_row; i++) {
+			word_t um = rowu[i];
+			word_t mm = rowm[i];
+			word_t lm = rl[i];
+			if(!mm) continue;
+
+			// neighbor to the left of x is bit x-1, so shift up
+			word_t ul = (um << 1) | (i ? rowu[i-1] >> (WORD_BITS-1) : 0);
+			word_t ml = (mm << 1) | (i ? rowm[i-1] >> (WORD_BITS-1) : 0);
+			word_t ll = (lm << 1) | (i ? rl  [i-1] >> (WORD_BITS-1) : 0);
+			bool more = i+1 < words_per_row;
+			word_t ur = (um >> 1) | (more ? rowu[i+1] << (WORD_BITS-1) : 0);
+			word_t mr = (mm >> 1) | (more ? rowm[i+1] << (WORD_BITS-1) : 0);
+			word_t lr = (lm >> 1) | (more ? rl  [i+1] << (WORD_BITS-1) : 0);
+
+			word_t keep =
+				(ul&um) | (um&ur) | (ur&mr) | (mr&lr) |
+				(lr&lm) | (lm&ll) | (ll&ml) | (ml&ul);
+			p[i] = mm & keep;
+		}
+	}
 }
 
-Vertex BitGrid::centroid() {
+Vertex BitGrid::centroid() const {
+	// For each word, the sum of the indices of the set bits is built up one
+	// index bit at a time: the k-th mask selects the bits whose index has
+	// bit k set.
+	static const word_t index_bit_masks[6] = {
+		0xaaaaaaaaaaaaaaaaULL,
+		0xccccccccccccccccULL,
+		0xf0f0f0f0f0f0f0f0ULL,
+		0xff00ff00ff00ff00ULL,
+		0xffff0000ffff0000ULL,
+		0xffffffff00000000ULL
+	};
+
 	int64_t accum_x=0, accum_y=0, cnt=0;
 	for(int y=0; y<h; y++) {
-		for(int x=0; x<w; x++) {
-			if(get(x, y)) {
-				accum_x += x;
-				accum_y += y;
-				cnt++;
+		const word_t *p = row(y);
+		int64_t row_cnt = 0;
+		for(int i=0; i<words_per_row; i++) {
+			word_t word = p[i];
+			if(!word) continue;
+			int64_t n = popcount64(word);
+			int64_t idx_sum = 0;
+			for(int k=0; k<6; k++) {
+				idx_sum += int64_t(popcount64(word & index_bit_masks[k])) << k;
 			}
+			accum_x += int64_t(i)*WORD_BITS*n + idx_sum;
+			row_cnt += n;
 		}
+		accum_y += int64_t(y) * row_cnt;
+		cnt += row_cnt;
 	}
 	return Vertex(
 		double(accum_x) / cnt,
@@ -30,38 +30,59 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 #ifndef DANGDAL_MASK_H
 #define DANGDAL_MASK_H
 
+#include <algorithm>
 #include <cassert>
 #include <vector>
 
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
 #include "common.h"
+#include "tiled-store.h"
 #include "polygon.h"
 #include "debugplot.h"
 #include "ndv.h"
 
 namespace dangdal {
 
+// Grids bigger than GRID_MEMORY_LIMIT are kept in a TiledStore rather than in
+// memory.  Copies of such a grid share the same store (only the in-memory
+// grids are deep copied), so don't modify a copy expecting the original to
+// stay untouched.
 template <typename T>
 class GridArray {
 public:
 	GridArray(int _w, int _h) :
-		w(_w), h(_h),
-		grid(w*h)
-	{ }
+		w(_w), h(_h)
+	{
+		size_t row_bytes = sizeof(T) * w;
+		if(GRID_MEMORY_LIMIT && row_bytes * h > GRID_MEMORY_LIMIT) {
+			tiles.reset(new TiledStore(row_bytes, h, GRID_MEMORY_LIMIT));
+		} else {
+			grid.resize(size_t(w)*h);
+		}
+	}
 
 // default dtor, copy, assign are OK
 
 public:
-	typename std::vector<T>::const_reference operator()(int x, int y) const {
+	bool is_tiled() const { return tiles.get() != NULL; }
+
+	const T &operator()(int x, int y) const {
 		// out-of-bounds used to be okay and return 'false' but not now
 		// FIXME - make sure that is okay
 		assert(x>=0 && y>=0 && x<w && y<h);
+		if(tiles) return reinterpret_cast<const T *>(tiles->get_row(y, false))[x];
 		return grid[size_t(y)*w + x];
 	}
 
-	typename std::vector<T>::reference operator()(int x, int y) {
+	T &operator()(int x, int y) {
 		// out-of-bounds used to be okay and return 'false' but not now
 		// FIXME - make sure that is okay
 		assert(x>=0 && y>=0 && x<w && y<h);
+		if(tiles) return reinterpret_cast<T *>(tiles->get_row(y, true))[x];
 		return grid[size_t(y)*w + x];
 	}
 
@@ -76,7 +97,7 @@ public:
 	}
 
 	// FIXME - deprecate
-	const typename std::vector<T>::const_reference get(int x, int y) const {
+	const T &get(int x, int y) const {
 		return (*this)(x, y);
 	}
 
@@ -86,34 +107,260 @@ public:
 	}
 
 	void zero() {
-		for(size_t i=0; i<grid.size(); i++) {
-			grid[i] = 0;
+		if(tiles) {
+			tiles->clear();
+		} else {
+			std::fill(grid.begin(), grid.end(), T(0));
 		}
 	}
 
 protected:
 	int w, h;
 	std::vector<T> grid;
+	boost::shared_ptr<TiledStore> tiles;
 };
 
-class BitGrid : public GridArray<bool> {
+// A two dimensional array of bits, packed 64 to a word.  Each row starts on a
+// word boundary and the bits past the right edge of the grid are always kept
+// clear, so that whole-word operations don't need to special case the edges.
+// Bit i of a word holds pixel x=(word_index*64 + i).  Like GridArray, big
+// grids are kept in a TiledStore (and copies of them share the store).
+class BitGrid {
 public:
-	BitGrid(int _w, int _h) : GridArray<bool>(_w, _h) { }
+	typedef uint64_t word_t;
+	static const int WORD_BITS = 64;
 
-	void invert() {
-		for(size_t i=0; i<grid.size(); i++) {
-			grid[i] = !grid[i];
+	BitGrid(int _w, int _h) :
+		w(_w), h(_h),
+		words_per_row((_w + WORD_BITS - 1) / WORD_BITS)
+	{
+		size_t row_bytes = sizeof(word_t) * words_per_row;
+		if(would_be_tiled(_w, _h)) {
+			tiles.reset(new TiledStore(row_bytes, h, GRID_MEMORY_LIMIT));
+		} else {
+			grid.resize(size_t(words_per_row) * h, 0);
 		}
 	}
 
+	// true if a grid of this size is kept in a TiledStore
+	static bool would_be_tiled(int w, int h) {
+		size_t row_bytes = sizeof(word_t) * ((w + WORD_BITS - 1) / WORD_BITS);
+		return GRID_MEMORY_LIMIT && row_bytes * h > GRID_MEMORY_LIMIT;
+	}
+
+// default dtor, copy, assign are OK
+
+public:
+	int width() const { return w; }
+	int height() const { return h; }
+	bool is_tiled() const { return tiles.get() != NULL; }
+	size_t get_words_per_row() const { return words_per_row; }
+
+	bool operator()(int x, int y) const {
+		assert(x>=0 && y>=0 && x<w && y<h);
+		return (row(y)[x / WORD_BITS] >> (x % WORD_BITS)) & 1;
+	}
+
+	bool get(int x, int y, bool default_val) const {
+		if(x>=0 && y>=0 && x<w && y<h) {
+			return (*this)(x, y);
+		} else {
+			return default_val;
+		}
+	}
+
+	// FIXME - deprecate
+	bool get(int x, int y) const {
+		return (*this)(x, y);
+	}
+
+	void set(int x, int y, bool val) {
+		assert(x>=0 && y>=0 && x<w && y<h);
+		word_t &word = row(y)[x / WORD_BITS];
+		word_t bit = word_t(1) << (x % WORD_BITS);
+		if(val) {
+			word |= bit;
+		} else {
+			word &= ~bit;
+		}
+	}
+
+	void zero() {
+		if(tiles) {
+			tiles->clear();
+		} else {
+			std::fill(grid.begin(), grid.end(), 0);
+		}
+	}
+
+	// Direct access to the packed words of a row.  Callers writing through
+	// this must leave the padding bits past the right edge clear.  For tiled
+	// grids, see TiledStore::get_row regarding how long the pointer is valid.
+	word_t *row(int y) {
+		assert(y>=0 && y<h);
+		if(tiles) return reinterpret_cast<word_t *>(tiles->get_row(y, true));
+		return &grid[size_t(y)*words_per_row];
+	}
+
+	const word_t *row(int y) const {
+		assert(y>=0 && y<h);
+		if(tiles) return reinterpret_cast<const word_t *>(tiles->get_row(y, false));
+		return &grid[size_t(y)*words_per_row];
+	}
+
+	// Sets pixels x0 <= x < x1 of row y to val.
+	void fill_span(int y, int x0, int x1, bool val);
+
+	// Returns the first x0 <= x < x1 such that pixel (x,y) equals val, or x1
+	// if there is no such pixel.
+	int find_next(int y, int x0, int x1, bool val) const;
+
+	// Returns the last x0 <= x < x1 such that pixel (x,y) equals val, or x0-1
+	// if there is no such pixel.
+	int find_prev(int y, int x0, int x1, bool val) const;
+
+	// Returns the first x0 <= x < x1 such that pixels (x,y) and (x,y-1)
+	// differ, or x1 if there is no such pixel.
+	int find_next_change(int y, int x0, int x1) const;
+
+	size_t count() const;
+
+	void invert();
+
 	void erode();
 
-	Vertex centroid();
+	Vertex centroid() const;
+
+private:
+	// mask of the valid bits in the last word of each row
+	word_t tail_mask() const {
+		int r = w % WORD_BITS;
+		return r ? (word_t(1) << r) - 1 : ~word_t(0);
+	}
+
+	int w, h;
+	int words_per_row;
+	std::vector<word_t> grid;
+	boost::shared_ptr<TiledStore> tiles;
 };
 
+// A mask stored as the runs of 'true' pixels of each row, in the same form
+// as row_crossings_t: x0,x1 pairs for the pixels x0 <= x < x1, in increasing
+// order.  This takes memory in proportion to the number of runs rather than
+// the number of pixels, which is much less for the usual NDV masks (a few big
+// regions) but much more for noisy ones.  Different rows can be filled in
+// by different threads.
+class RleMask {
+public:
+	typedef std::vector<int> runs_t;
+
+	RleMask(int _w, int _h) : w(_w), h(_h), rows(_h) { }
+
+// default dtor, copy, assign are OK
+
+	int width() const { return w; }
+	int height() const { return h; }
+
+	const runs_t &runs(int y) const {
+		assert(y>=0 && y<h);
+		return rows[y];
+	}
+
+	bool operator()(int x, int y) const {
+		assert(x>=0 && y>=0 && x<w && y<h);
+		const runs_t &r = rows[y];
+		// inside of a run if an odd number of run ends are <= x
+		return (std::upper_bound(r.begin(), r.end(), x) - r.begin()) & 1;
+	}
+
+	// Appends the run x0 <= x < x1 to row y.  It must come after the runs
+	// already in the row, and is joined to the last one if they touch.
+	void add_run(int y, int x0, int x1) {
+		assert(y>=0 && y<h && x0>=0 && x0<x1 && x1<=w);
+		runs_t &r = rows[y];
+		assert(r.empty() || r.back() <= x0);
+		if(!r.empty() && r.back() == x0) {
+			r.back() = x1;
+		} else {
+			r.push_back(x0);
+			r.push_back(x1);
+		}
+	}
+
+	// Returns the first x > x0 such that pixels (x,y) and (x0,y) differ, or
+	// w if there is no such pixel.
+	int run_end(int y, int x0) const {
+		assert(y>=0 && y<h && x0>=0 && x0<w);
+		const runs_t &r = rows[y];
+		runs_t::const_iterator it = std::upper_bound(r.begin(), r.end(), x0);
+		return it == r.end() ? w : *it;
+	}
+
+	// Returns the first x <= x0 such that pixels x through x0 of row y are
+	// all the same.
+	int run_start(int y, int x0) const {
+		assert(y>=0 && y<h && x0>=0 && x0<w);
+		const runs_t &r = rows[y];
+		runs_t::const_iterator it = std::upper_bound(r.begin(), r.end(), x0);
+		return it == r.begin() ? 0 : *(it-1);
+	}
+
+	// Returns the first x0 <= x < x1 such that pixels (x,y) and (x,y-1)
+	// differ, or x1 if there is no such pixel.
+	int find_next_change(int y, int x0, int x1) const;
+
+	size_t num_runs() const;
+
+private:
+	int w, h;
+	std::vector<runs_t> rows;
+};
+
+// Keeps track of which rows of a grid have been filled in, so that another
+// thread can start working on the rows at the top while the rest are still
+// being read.
+class RowsReady : boost::noncopyable {
+public:
+	explicit RowsReady(int h) : done(h, false), num_ready(0) { }
+
+	// Marks rows y0 <= y < y1 as filled in.
+	void set_ready(int y0, int y1);
+
+	// Waits until every row up to and including y has been filled in, and
+	// returns the number of rows at the top that have been.
+	int wait_for(int y);
+
+private:
+	boost::mutex lock;
+	boost::condition_variable cond;
+	std::vector<bool> done;
+	int num_ready;
+};
+
+// If set, the readers below guess from a low resolution copy of the dataset
+// which blocks are all valid or all NDV, and only read the rest.  This saves
+// reading the inside and outside of a big valid region, but small features
+// inside of blocks taken to be all one thing are missed.
+extern bool COARSE_TO_FINE;
+
 // Returns a BitGrid with 'true' values correspond to valid (not ndv) pixels.
+// Blocks are read using up to num_threads threads, each with its own handle
+// to the dataset.
 BitGrid get_bitgrid_for_dataset(GDALDatasetH ds, const std::vector<size_t> &bandlist,
-	const NdvDef &ndv_def, DebugPlot *dbuf);
+	const NdvDef &ndv_def, DebugPlot *dbuf, int num_threads);
+
+// Same as get_bitgrid_for_dataset, but fills in the given mask, which must be
+// the size of the dataset and all zeros.  If rows_ready is given, each row of
+// blocks is reported to it as soon as it is done.
+void read_bitgrid_for_dataset(GDALDatasetH ds, const std::vector<size_t> &bandlist,
+	const NdvDef &ndv_def, DebugPlot *dbuf, int num_threads,
+	BitGrid &mask, RowsReady *rows_ready);
+
+// Same as read_bitgrid_for_dataset, but for an RleMask, which must be the
+// size of the dataset and empty.
+void read_rle_mask_for_dataset(GDALDatasetH ds, const std::vector<size_t> &bandlist,
+	const NdvDef &ndv_def, DebugPlot *dbuf, int num_threads,
+	RleMask &mask, RowsReady *rows_ready);
 
 } // namespace dangdal
 
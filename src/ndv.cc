@@ -27,8 +27,10 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 
 
 #include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <cassert>
+#include <limits>
 
 #include <boost/foreach.hpp>
 #include <boost/lexical_cast.hpp>
@@ -186,55 +188,347 @@ inline bool NdvInterval::contains(const void *p, GDALDataType dt) const {
 	return DANGDAL_RUNTIME_TEMPLATE(dt, contains_templated, this, p);
 }
 
-void NdvDef::getNdvMask(
-	const std::vector<const void *> &bands,
-	const std::vector<GDALDataType> &dt_list,
-	uint8_t *mask_out, size_t num_pixels
-) const {
-	assert(bands.size() == dt_list.size());
-	// use uint8_t to allow incrementing the pointer by bytes
-	std::vector<const uint8_t *> in_p;
+template <typename T>
+struct CanBeNaN { static const bool value = false; };
+template <> struct CanBeNaN<float> { static const bool value = true; };
+template <> struct CanBeNaN<double> { static const bool value = true; };
+template <> struct CanBeNaN<std::complex<float> > { static const bool value = true; };
+template <> struct CanBeNaN<std::complex<double> > { static const bool value = true; };
+
+template <typename T>
+static inline bool value_isnan(T v) { return std::isnan(v); }
+
+template <typename T>
+static inline bool value_isnan(std::complex<T> v) {
+	return std::isnan(v.real()) || std::isnan(v.imag());
+}
+
+// Sets mask_out[i] for pixels that are NaN.
+template <typename T>
+static void or_nan_pixels(const void *p, size_t num_pixels, uint8_t *mask_out) {
+	if(!CanBeNaN<T>::value) return;
+	const T *in = reinterpret_cast<const T *>(p);
+	for(size_t i=0; i<num_pixels; i++) {
+		mask_out[i] |= value_isnan(in[i]) ? 1 : 0;
+	}
+}
+
+// Finds the values of T that fall in the interval, as a range lo..hi of that
+// type, returning false if there are none.  Only for integer types.
+template <typename T>
+static bool integer_bounds(const NdvInterval &interval, T &lo, T &hi) {
+	// this also catches NaN endpoints, which never compare as true
+	if(!(interval.first <= interval.second)) return false;
+	double min_d = ceil(interval.first);
+	double max_d = floor(interval.second);
+	double type_min = std::numeric_limits<T>::min();
+	double type_max = std::numeric_limits<T>::max();
+	if(min_d > type_max || max_d < type_min || min_d > max_d) return false;
+	lo = min_d < type_min ? std::numeric_limits<T>::min() : T(min_d);
+	hi = max_d > type_max ? std::numeric_limits<T>::max() : T(max_d);
+	return true;
+}
+
+template <typename T>
+static inline double real_value(T v) { return v; }
+
+template <typename T>
+static inline double real_value(std::complex<T> v) { return v.real(); }
+
+// One band's part of the test for one slab, with the interval converted to
+// suit the band's datatype.  fn clears acc[i] for pixels that don't match.
+struct NdvBandTest;
+typedef void (*NdvBandTestFn)(
+	const void *p, size_t num_pixels, const NdvBandTest &test, uint8_t *acc);
+
+struct NdvBandTest {
+	size_t band_idx;
+	NdvBandTestFn fn;
+	// the interval, for floating point and complex (real part) data
+	double lo, hi;
+	// the interval, for integer data
+	int64_t int_lo, int_hi;
+};
+
+typedef void (*NdvNanFn)(const void *p, size_t num_pixels, uint8_t *mask_out);
+
+template <typename T, bool is_integer=std::numeric_limits<T>::is_integer>
+struct NdvTestKernels {
+	static void and_equal(const void *p, size_t num_pixels, const NdvBandTest &test, uint8_t *acc) {
+		const T *in = reinterpret_cast<const T *>(p);
+		const double v0 = test.lo;
+		for(size_t i=0; i<num_pixels; i++) {
+			acc[i] &= real_value(in[i]) == v0;
+		}
+	}
+
+	static void and_in_range(const void *p, size_t num_pixels, const NdvBandTest &test, uint8_t *acc) {
+		const T *in = reinterpret_cast<const T *>(p);
+		const double lo = test.lo;
+		const double hi = test.hi;
+		for(size_t i=0; i<num_pixels; i++) {
+			double v = real_value(in[i]);
+			acc[i] &= (v >= lo) & (v <= hi);
+		}
+	}
+
+	// Returns false if no value can match.  Leaves fn NULL if every value
+	// matches.
+	static bool make_test(const NdvInterval &interval, NdvBandTest &test) {
+		// this also catches NaN endpoints, which never compare as true
+		if(!(interval.first <= interval.second)) return false;
+		test.lo = interval.first;
+		test.hi = interval.second;
+		// (-Inf..Inf still has to rule out NaN)
+		test.fn = test.lo == test.hi ? and_equal : and_in_range;
+		return true;
+	}
+};
+
+template <typename T>
+struct NdvTestKernels<T, true> {
+	static void and_equal(const void *p, size_t num_pixels, const NdvBandTest &test, uint8_t *acc) {
+		const T *in = reinterpret_cast<const T *>(p);
+		const T v0 = T(test.int_lo);
+		for(size_t i=0; i<num_pixels; i++) {
+			acc[i] &= in[i] == v0;
+		}
+	}
+
+	static void and_in_range(const void *p, size_t num_pixels, const NdvBandTest &test, uint8_t *acc) {
+		const T *in = reinterpret_cast<const T *>(p);
+		const T lo = T(test.int_lo);
+		const T hi = T(test.int_hi);
+		for(size_t i=0; i<num_pixels; i++) {
+			acc[i] &= (in[i] >= lo) & (in[i] <= hi);
+		}
+	}
+
+	static bool make_test(const NdvInterval &interval, NdvBandTest &test) {
+		T lo, hi;
+		if(!integer_bounds(interval, lo, hi)) return false;
+		test.int_lo = lo;
+		test.int_hi = hi;
+		if(lo == std::numeric_limits<T>::min() && hi == std::numeric_limits<T>::max()) {
+			test.fn = NULL;
+		} else {
+			test.fn = lo == hi ? and_equal : and_in_range;
+		}
+		return true;
+	}
+};
+
+template <typename T>
+static bool make_band_test(const NdvInterval &interval, NdvBandTest &test) {
+	return NdvTestKernels<T>::make_test(interval, test);
+}
+
+template <typename T>
+static NdvNanFn get_nan_fn() {
+	return CanBeNaN<T>::value ? or_nan_pixels<T> : NULL;
+}
+
+template <typename T>
+static bool can_be_nan_templated() {
+	return CanBeNaN<T>::value;
+}
+
+bool datatype_can_be_nan(GDALDataType dt) {
+	return DANGDAL_RUNTIME_TEMPLATE(dt, can_be_nan_templated);
+}
+
+// The general case: each slab is a list of per-band tests, run over chunks of
+// pixels so that the inner loops are simple enough for the compiler to
+// vectorize.
+class GenericNdvPredicate : public NdvPredicate {
+public:
+	GenericNdvPredicate(const NdvDef &ndv_def, const std::vector<GDALDataType> &dt_list);
+
+	void getNdvMask(
+		const std::vector<const void *> &bands,
+		uint8_t *mask_out, size_t num_pixels
+	) const;
+
+private:
+	static const size_t CHUNK_SIZE = 4096;
+
 	std::vector<size_t> dt_sizes;
-	for(size_t i=0; i<bands.size(); i++) {
-		in_p.push_back(reinterpret_cast<const uint8_t *>(bands[i]));
+	std::vector<NdvNanFn> nan_fns;
+	std::vector<std::vector<NdvBandTest> > slab_tests;
+	// some slab matches everything
+	bool match_all;
+	bool invert;
+};
+
+GenericNdvPredicate::GenericNdvPredicate(
+	const NdvDef &ndv_def, const std::vector<GDALDataType> &dt_list
+) :
+	match_all(false), invert(ndv_def.invert)
+{
+	for(size_t i=0; i<dt_list.size(); i++) {
 		dt_sizes.push_back(GDALGetDataTypeSize(dt_list[i]) / 8);
+		nan_fns.push_back(DANGDAL_RUNTIME_TEMPLATE(dt_list[i], get_nan_fn));
 	}
 
-	BOOST_FOREACH(const NdvSlab &slab, slabs) {
-		size_t num_intervals = slab.range_by_band.size();
-		assert(num_intervals == bands.size() || num_intervals == 1);
+	BOOST_FOREACH(const NdvSlab &slab, ndv_def.slabs) {
+		std::vector<NdvBandTest> tests;
+		bool can_match = true;
+		for(size_t i=0; i<dt_list.size(); i++) {
+			size_t num_intervals = slab.range_by_band.size();
+			// if only one interval is given, use it for all bands
+			size_t j = num_intervals==1 ? 0 : i;
+			NdvBandTest test;
+			test.band_idx = i;
+			if(!DANGDAL_RUNTIME_TEMPLATE(dt_list[i], make_band_test, slab.range_by_band[j], test)) {
+				can_match = false;
+				break;
+			}
+			if(test.fn) tests.push_back(test);
+		}
+		if(!can_match) continue;
+		if(tests.empty()) match_all = true;
+		slab_tests.push_back(tests);
+	}
+}
+
+void GenericNdvPredicate::getNdvMask(
+	const std::vector<const void *> &bands,
+	uint8_t *mask_out, size_t num_pixels
+) const {
+	assert(bands.size() == dt_sizes.size());
+
+	if(match_all) {
+		memset(mask_out, invert ? 0 : 1, num_pixels);
+		return;
 	}
 
-	memset(mask_out, 0, num_pixels);
-	for(size_t pix_idx=0; pix_idx<num_pixels; pix_idx++) {
-		mask_out[pix_idx] = 0;
+	uint8_t slab_match[CHUNK_SIZE];
+
+	for(size_t chunk_start=0; chunk_start<num_pixels; chunk_start+=CHUNK_SIZE) {
+		size_t n = std::min(size_t(CHUNK_SIZE), num_pixels - chunk_start);
+		uint8_t *out = mask_out + chunk_start;
+		memset(out, 0, n);
 
 		// A NaN value on any band makes this pixel NDV.
 		for(size_t i=0; i<bands.size(); i++) {
-			if(gdal_scalar_pointer_isnan(in_p[i], dt_list[i])) {
-				mask_out[pix_idx] = 1;
-			}
+			if(!nan_fns[i]) continue;
+			const uint8_t *p = reinterpret_cast<const uint8_t *>(bands[i]);
+			nan_fns[i](p + chunk_start * dt_sizes[i], n, out);
 		}
 
-		BOOST_FOREACH(const NdvSlab &slab, slabs) {
-			bool all_match = true;
-			for(size_t i=0; i<bands.size(); i++) {
-				size_t num_intervals = slab.range_by_band.size();
-				// if only one interval is given, use it for all bands
-				size_t j = num_intervals==1 ? 0 : i;
-				all_match &= slab.range_by_band[j].contains(in_p[i], dt_list[i]);
+		BOOST_FOREACH(const std::vector<NdvBandTest> &tests, slab_tests) {
+			memset(slab_match, 1, n);
+			BOOST_FOREACH(const NdvBandTest &test, tests) {
+				const uint8_t *p = reinterpret_cast<const uint8_t *>(bands[test.band_idx]);
+				test.fn(p + chunk_start * dt_sizes[test.band_idx], n, test, slab_match);
 			}
-			mask_out[pix_idx] |= all_match;
+			for(size_t k=0; k<n; k++) out[k] |= slab_match[k];
 		}
 
 		if(invert) {
-			mask_out[pix_idx] = mask_out[pix_idx] ? 0 : 1;
+			for(size_t k=0; k<n; k++) out[k] ^= 1;
+		}
+	}
+}
+
+// For byte data, the answer for every possible value of each band can be
+// worked out up front.  Bit s of lut[band][v] says whether slab s matches value
+// v on that band.  With a single band, the lookup gives the answer directly.
+class ByteLutNdvPredicate : public NdvPredicate {
+public:
+	ByteLutNdvPredicate(const NdvDef &ndv_def, size_t num_bands);
+
+	void getNdvMask(
+		const std::vector<const void *> &bands,
+		uint8_t *mask_out, size_t num_pixels
+	) const;
+
+	static const size_t MAX_SLABS = 32;
+
+private:
+	std::vector<std::vector<uint32_t> > lut;
+	uint8_t single_band_lut[256];
+	// one bit for each slab
+	uint32_t all_slabs;
+	bool invert;
+};
+
+ByteLutNdvPredicate::ByteLutNdvPredicate(const NdvDef &ndv_def, size_t num_bands) :
+	lut(num_bands, std::vector<uint32_t>(256, 0)), all_slabs(0), invert(ndv_def.invert)
+{
+	assert(ndv_def.slabs.size() <= MAX_SLABS);
+	for(size_t s=0; s<ndv_def.slabs.size(); s++) all_slabs |= uint32_t(1) << s;
+	for(size_t s=0; s<ndv_def.slabs.size(); s++) {
+		const NdvSlab &slab = ndv_def.slabs[s];
+		for(size_t i=0; i<num_bands; i++) {
+			size_t num_intervals = slab.range_by_band.size();
+			size_t j = num_intervals==1 ? 0 : i;
+			for(int v=0; v<256; v++) {
+				if(slab.range_by_band[j].contains(uint8_t(v))) lut[i][v] |= uint32_t(1) << s;
+			}
+		}
+	}
+	for(int v=0; v<256; v++) {
+		bool is_ndv = num_bands == 1 && lut[0][v];
+		single_band_lut[v] = is_ndv != invert ? 1 : 0;
+	}
+}
+
+void ByteLutNdvPredicate::getNdvMask(
+	const std::vector<const void *> &bands,
+	uint8_t *mask_out, size_t num_pixels
+) const {
+	assert(bands.size() == lut.size());
+
+	if(bands.size() == 1) {
+		const uint8_t *in = reinterpret_cast<const uint8_t *>(bands[0]);
+		for(size_t k=0; k<num_pixels; k++) {
+			mask_out[k] = single_band_lut[in[k]];
 		}
+		return;
+	}
 
-		for(size_t band_idx=0; band_idx<bands.size(); band_idx++) {
-			in_p[band_idx] += dt_sizes[band_idx];
+	const uint8_t inv = invert ? 1 : 0;
+	for(size_t k=0; k<num_pixels; k++) {
+		uint32_t slabs_matched = all_slabs;
+		for(size_t i=0; i<bands.size(); i++) {
+			slabs_matched &= lut[i][reinterpret_cast<const uint8_t *>(bands[i])[k]];
 		}
+		mask_out[k] = (slabs_matched ? 1 : 0) ^ inv;
+	}
+}
+
+boost::shared_ptr<const NdvPredicate> NdvDef::compile(
+	const std::vector<GDALDataType> &dt_list
+) const {
+	BOOST_FOREACH(const NdvSlab &slab, slabs) {
+		size_t num_intervals = slab.range_by_band.size();
+		assert(num_intervals == dt_list.size() || num_intervals == 1);
+	}
+
+	// A single slab that is one range on every band is left to the generic
+	// code, whose vectorized compares beat a table lookup.
+	bool all_byte = !dt_list.empty();
+	BOOST_FOREACH(GDALDataType dt, dt_list) {
+		if(dt != GDT_Byte) all_byte = false;
 	}
+	bool simple = slabs.size() == 1 && dt_list.size() == 1;
+	if(all_byte && !simple && slabs.size() <= ByteLutNdvPredicate::MAX_SLABS) {
+		return boost::shared_ptr<const NdvPredicate>(
+			new ByteLutNdvPredicate(*this, dt_list.size()));
+	} else {
+		return boost::shared_ptr<const NdvPredicate>(
+			new GenericNdvPredicate(*this, dt_list));
+	}
+}
+
+void NdvDef::getNdvMask(
+	const std::vector<const void *> &bands,
+	const std::vector<GDALDataType> &dt_list,
+	uint8_t *mask_out, size_t num_pixels
+) const {
+	assert(bands.size() == dt_list.size());
+	compile(dt_list)->getNdvMask(bands, mask_out, num_pixels);
 }
 
 void NdvDef::getNdvMask(
@@ -36,6 +36,8 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 #include <complex>
 
 #include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include <gdal.h>
 
@@ -70,6 +72,19 @@ struct NdvSlab {
 	std::vector<NdvInterval> range_by_band;
 };
 
+// An NdvDef worked out ahead of time for a particular list of band datatypes,
+// for computing the masks of many blocks.  See NdvDef::compile.
+class NdvPredicate : boost::noncopyable {
+public:
+	virtual ~NdvPredicate() { }
+
+	// Same as NdvDef::getNdvMask, for bands of the datatypes given to compile.
+	virtual void getNdvMask(
+		const std::vector<const void *> &bands,
+		uint8_t *mask_out, size_t num_pixels
+	) const = 0;
+};
+
 class NdvDef {
 public:
 	static void printUsage();
@@ -79,6 +94,10 @@ public:
 	bool empty() const { return slabs.empty(); }
 	bool isInvert() const { return invert; }
 
+	// Works out the NDV test for bands of the given datatypes up front, so
+	// that none of it is redone for each block or pixel.
+	boost::shared_ptr<const NdvPredicate> compile(const std::vector<GDALDataType> &dt_list) const;
+
 	void getNdvMask(
 		const void *band, GDALDataType dt,
 		uint8_t *mask_out, size_t num_pixels
@@ -125,6 +144,9 @@ public:
 	std::vector<NdvSlab> slabs;
 };
 
+// NaN pixels are always NDV, for datatypes that can hold them.
+bool datatype_can_be_nan(GDALDataType dt);
+
 } // namespace dangdal
 
 #endif // DANGDAL_NDV_H
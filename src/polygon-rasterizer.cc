@@ -27,6 +27,7 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 
 
 #include <algorithm>
+#include <cstring>
 #include <string>
 #include <vector>
 
@@ -40,8 +41,8 @@ namespace dangdal {
 
 typedef std::vector<double> row_crossings_dbl_t;
 
-row_crossings_t crossings_dbl_to_int(const row_crossings_dbl_t &in) {
-	row_crossings_t out;
+static void crossings_dbl_to_int(const row_crossings_dbl_t &in, row_crossings_t &out) {
+	out.clear();
 	for(size_t i=0; i<in.size(); i+=2) {
 		int from = (int)ceil(in[i] - EPSILON);
 		int to = (int)floor(in[i+1] + EPSILON);
@@ -50,115 +51,192 @@ row_crossings_t crossings_dbl_to_int(const row_crossings_dbl_t &in) {
 			out.push_back(to);
 		}
 	}
-	return out;
 }
 
-// This function returns a list of pixel ranges for each row.  The ranges
-// consist of pixels that are entirely contained within the polygon.  The
-// results will be slightly wrong for polygons whose vertices are not integers.
-std::vector<row_crossings_t> get_row_crossings(
-	const Mpoly &mpoly, int min_y, int num_rows
-) {
-	std::vector<row_crossings_dbl_t> rows_top(num_rows);
-	std::vector<row_crossings_dbl_t> rows_bot(num_rows);
-
-	for(size_t i=0; i<mpoly.rings.size(); i++) {
-		const Ring &c = mpoly.rings[i];
-		size_t npts = c.pts.size();
-		for(size_t j=0; j<npts; j++) {
-			size_t j_plus1 = (j==npts-1) ? 0 : (j+1);
-			double x0 = c.pts[j].x;
-			double y0 = c.pts[j].y;
-			double x1 = c.pts[j_plus1].x;
-			double y1 = c.pts[j_plus1].y;
-			if(y0 == y1) continue;
-			if(y0 > y1) {
-				double tmp;
-				tmp=x0; x0=x1; x1=tmp; 
-				tmp=y0; y0=y1; y1=tmp; 
-			}
-			double alpha = (x1-x0) / (y1-y0);
-			int y0i = (int)round(y0);
-			int y1i = (int)round(y1);
-			for(int y=y0i; y<=y1i; y++) {
-				double x = x0 + ((double)y - y0)*alpha;
-
-				int row = y - min_y - 1;
-				if(y > y0i && row >= 0 && row < num_rows) {
-					row_crossings_dbl_t &r = rows_bot[row];
-					r.push_back(x);
-				}
+static void crossings_intersection(
+	const row_crossings_t &in1, const row_crossings_t &in2, row_crossings_t &out
+);
 
-				row = y - min_y;
-				if(y < y1i && row >= 0 && row < num_rows) {
-					row_crossings_dbl_t &r = rows_top[row];
-					r.push_back(x);
+// Goes down the rows of a polygon one at a time, giving the pixel ranges of
+// each (see get_row_crossings).  The edges are kept in a table sorted by
+// the row they start on, and only the ones that reach the current row are
+// looked at, so each row takes time in proportion to the number of edges it
+// crosses rather than the number of edges there are.
+class RowCrossingsSweep {
+public:
+	// Rows from min_y up to (not including) end_y can be asked for.
+	RowCrossingsSweep(const Mpoly &mpoly, int min_y, int end_y) : next_edge(0), y(min_y) {
+		size_t total_pts = 0;
+		for(size_t i=0; i<mpoly.rings.size(); i++) {
+			total_pts += mpoly.rings[i].pts.size();
+		}
+		edges.reserve(total_pts);
+		for(size_t i=0; i<mpoly.rings.size(); i++) {
+			const Ring &c = mpoly.rings[i];
+			size_t npts = c.pts.size();
+			for(size_t j=0; j<npts; j++) {
+				size_t j_plus1 = (j==npts-1) ? 0 : (j+1);
+				double x0 = c.pts[j].x;
+				double y0 = c.pts[j].y;
+				double x1 = c.pts[j_plus1].x;
+				double y1 = c.pts[j_plus1].y;
+				if(y0 == y1) continue;
+				if(y0 > y1) {
+					std::swap(x0, x1);
+					std::swap(y0, y1);
 				}
+				Edge e;
+				e.x0 = x0;
+				e.y0 = y0;
+				e.alpha = (x1-x0) / (y1-y0);
+				e.y0i = (int)round(y0);
+				e.y1i = (int)round(y1);
+				// such an edge doesn't cross any row
+				if(e.y0i == e.y1i) continue;
+				// nor any that are outside of the rows wanted
+				if(e.y1i < min_y || e.y0i > end_y) continue;
+				edges.push_back(e);
 			}
 		}
+		std::sort(edges.begin(), edges.end(), edge_starts_before);
+		active.reserve(edges.size());
 	}
 
-	std::vector<row_crossings_t> rows_out(num_rows);
+	// Returns the pixel ranges of the next row, starting with min_y.  The
+	// reference is good until the next call.
+	const row_crossings_t &next_row() {
+		// Edges that reach the top or bottom of this row.
+		while(next_edge < edges.size() && edges[next_edge].y0i <= y+1) {
+			active.push_back(edges[next_edge++]);
+		}
+		size_t num_active = 0;
+		for(size_t i=0; i<active.size(); i++) {
+			if(active[i].y1i >= y) active[num_active++] = active[i];
+		}
+		active.resize(num_active);
 
-	for(int row=0; row<num_rows; row++) {
-		std::sort(rows_top[row].begin(), rows_top[row].end());
-		std::sort(rows_bot[row].begin(), rows_bot[row].end());
-		row_crossings_t top = crossings_dbl_to_int(rows_top[row]);
-		row_crossings_t bot = crossings_dbl_to_int(rows_bot[row]);
+		top_dbl.clear();
+		bot_dbl.clear();
+		for(size_t i=0; i<active.size(); i++) {
+			const Edge &e = active[i];
+			if(e.y0i <= y && y < e.y1i) {
+				top_dbl.push_back(e.x0 + ((double)y - e.y0)*e.alpha);
+			}
+			if(e.y0i < y+1 && y+1 <= e.y1i) {
+				bot_dbl.push_back(e.x0 + ((double)(y+1) - e.y0)*e.alpha);
+			}
+		}
+		y++;
+
+		std::sort(top_dbl.begin(), top_dbl.end());
+		std::sort(bot_dbl.begin(), bot_dbl.end());
+		crossings_dbl_to_int(top_dbl, top);
+		crossings_dbl_to_int(bot_dbl, bot);
 		if(top.size() && bot.size()) {
-			row_crossings_t c = crossings_intersection(top, bot);
-			std::swap(rows_out[row], c);
+			crossings_intersection(top, bot, out);
+			return out;
 		} else if(!top.empty()) {
-			std::swap(rows_out[row], top);
-		} else if(!bot.empty()) {
-			std::swap(rows_out[row], bot);
+			return top;
 		} else {
-			// no-op: leave rows_out[row] empty
+			return bot;
 		}
 	}
 
-	return rows_out;
+private:
+	struct Edge {
+		// lower end (in terms of y) and slope
+		double x0, y0, alpha;
+		// range of rows, rounded
+		int y0i, y1i;
+	};
+
+	static bool edge_starts_before(const Edge &a, const Edge &b) {
+		return a.y0i < b.y0i;
+	}
+
+	std::vector<Edge> edges;
+	size_t next_edge;
+	std::vector<Edge> active;
+	int y;
+	// These are kept from row to row to save allocating them each time.
+	row_crossings_dbl_t top_dbl, bot_dbl;
+	row_crossings_t top, bot, out;
+};
+
+// This function returns a list of pixel ranges for each row.  The ranges
+// consist of pixels that are entirely contained within the polygon.  The
+// results will be slightly wrong for polygons whose vertices are not integers.
+RowCrossingsTable get_row_crossings(
+	const Mpoly &mpoly, int min_y, int num_rows
+) {
+	RowCrossingsTable table;
+	table.row_begin.reserve(std::max(num_rows, 0) + 1);
+	table.row_begin.push_back(0);
+	RowCrossingsSweep sweep(mpoly, min_y, min_y+num_rows);
+	for(int row=0; row<num_rows; row++) {
+		const row_crossings_t &r = sweep.next_row();
+		table.crossings.insert(table.crossings.end(), r.begin(), r.end());
+		table.row_begin.push_back(table.crossings.size());
+	}
+	return table;
+}
+
+// Clears bits [from, to) of a PBM row, in which the leftmost pixel is the
+// high bit of the first byte.
+static void clear_pbm_span(uint8_t *row, size_t from, size_t to) {
+	if(from >= to) return;
+	size_t from_byte = from / 8;
+	size_t to_byte = to / 8;
+	uint8_t head_mask = uint8_t(0xff >> (from % 8));
+	uint8_t tail_mask = uint8_t(0xff00 >> (to % 8));
+	if(from_byte == to_byte) {
+		row[from_byte] &= ~(head_mask & tail_mask);
+		return;
+	}
+	row[from_byte] &= ~head_mask;
+	memset(row + from_byte + 1, 0, to_byte - from_byte - 1);
+	if(to % 8) row[to_byte] &= ~tail_mask;
 }
 
 void mask_from_mpoly(const Mpoly &mpoly, size_t w, size_t h, const std::string &fn) {
 	printf("mask draw: begin\n");
 
-	std::vector<row_crossings_t> rows = get_row_crossings(mpoly, 0, h);
-
-	printf("mask draw: write\n");
-
 	FILE *fout = fopen(fn.c_str(), "wb");
 	if(!fout) fatal_error("cannot open mask output");
 	fprintf(fout, "P4\n%zd %zd\n", w, h);
-	std::vector<uint8_t> buf((w+7)/8);
+	size_t row_bytes = (w+7)/8;
+	std::vector<uint8_t> buf(row_bytes);
+	row_crossings_t sorted;
+	RowCrossingsSweep sweep(mpoly, 0, int(h));
 	for(size_t y=0; y<h; y++) {
-		buf.assign((w+7)/8, 0);
-		uint8_t *p = &buf[0];
-		uint8_t bitp = 128;
-		const row_crossings_t &r = rows[y];
-		for(size_t i=0; i<w; i++) {
-			uint8_t v = 1;
-			// not the fastest way...
-			for(size_t j=0; j<r.size(); j++) {
-				if(double(i) >= r[j]) v = !v;
-			}
-			if(v) *p |= bitp;
-			bitp >>= 1;
-			if(!bitp) {
-				p++;
-				bitp = 128;
-			}
+		const row_crossings_t &r = sweep.next_row();
+		// A pixel is set when an even number of crossings are at or left of
+		// it, so this is the same even if the ranges were to overlap.
+		sorted = r;
+		std::sort(sorted.begin(), sorted.end());
+		if(sorted.size() % 2) sorted.push_back(int(w));
+
+		// Set every pixel outside the polygon, then clear the spans inside.
+		// The bits past the end of the row stay clear.
+		if(row_bytes) {
+			memset(&buf[0], 0xff, row_bytes);
+			if(w % 8) buf[row_bytes-1] = uint8_t(0xff00 >> (w % 8));
+		}
+		for(size_t j=0; j<sorted.size(); j+=2) {
+			size_t from = size_t(std::min(std::max(sorted[j  ], 0), int(w)));
+			size_t to   = size_t(std::min(std::max(sorted[j+1], 0), int(w)));
+			clear_pbm_span(&buf[0], from, to);
 		}
-		fwrite(&buf[0], (w+7)/8, 1, fout);
+		fwrite(&buf[0], row_bytes, 1, fout);
 	}
 	fclose(fout);
 	printf("mask draw: done\n");
 }
 
-row_crossings_t crossings_intersection(
-	const row_crossings_t &in1, const row_crossings_t &in2
+static void crossings_intersection(
+	const row_crossings_t &in1, const row_crossings_t &in2, row_crossings_t &out
 ) {
-	row_crossings_t out;
+	out.clear();
 	size_t n1 = in1.size();
 	size_t n2 = in2.size();
 	size_t p1=0, p2=0;
@@ -194,6 +272,13 @@ row_crossings_t crossings_intersection(
 		out.push_back(open);
 		out.push_back(close);
 	}
+}
+
+row_crossings_t crossings_intersection(
+	const row_crossings_t &in1, const row_crossings_t &in2
+) {
+	row_crossings_t out;
+	crossings_intersection(in1, in2, out);
 	return out;
 }
 
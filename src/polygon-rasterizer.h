@@ -39,7 +39,19 @@ namespace dangdal {
 
 typedef std::vector<int> row_crossings_t;
 
-std::vector<row_crossings_t> get_row_crossings(const Mpoly &mpoly, int min_y, int num_rows);
+// The pixel ranges of several rows, all kept in one array: the ranges of row
+// i (counting from the first row asked for) are [crossings[2*j],
+// crossings[2*j+1]) for row_begin[i]/2 <= j < row_begin[i+1]/2.
+struct RowCrossingsTable {
+	size_t num_rows() const { return row_begin.size() - 1; }
+	const int *row(size_t i) const { return crossings.empty() ? NULL : &crossings[0] + row_begin[i]; }
+	size_t row_size(size_t i) const { return row_begin[i+1] - row_begin[i]; }
+
+	std::vector<int> crossings;
+	std::vector<size_t> row_begin;
+};
+
+RowCrossingsTable get_row_crossings(const Mpoly &mpoly, int min_y, int num_rows);
 
 void mask_from_mpoly(const Mpoly &mpoly, size_t w, size_t h, const std::string &fn);
 
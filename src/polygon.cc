@@ -28,6 +28,8 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 
 #include <string>
 
+#include <boost/thread.hpp>
+
 #include "common.h"
 #include "polygon.h"
 #include "georef.h"
@@ -544,31 +546,27 @@ void compute_containments(mpoly_t *mp) {
 }
 */
 
-void Mpoly::xy2en(const GeoRef &georef) {
+void Mpoly::translate(double dx, double dy) {
 	for(size_t r_idx=0; r_idx<rings.size(); r_idx++) {
 		Ring &ring = rings[r_idx];
 		for(size_t v_idx=0; v_idx<ring.pts.size(); v_idx++) {
-			double x = ring.pts[v_idx].x;
-			double y = ring.pts[v_idx].y;
-			double east, north;
-			georef.xy2en(x, y, &east, &north);
-			ring.pts[v_idx].x = east;
-			ring.pts[v_idx].y = north;
+			ring.pts[v_idx].x += dx;
+			ring.pts[v_idx].y += dy;
 		}
 	}
 }
 
+void Mpoly::xy2en(const GeoRef &georef) {
+	for(size_t r_idx=0; r_idx<rings.size(); r_idx++) {
+		if(rings[r_idx].pts.empty()) continue;
+		georef.xy2en(rings[r_idx].pts);
+	}
+}
+
 void Mpoly::en2xy(const GeoRef &georef) {
 	for(size_t r_idx=0; r_idx<rings.size(); r_idx++) {
-		Ring &ring = rings[r_idx];
-		for(size_t v_idx=0; v_idx<ring.pts.size(); v_idx++) {
-			double east  = ring.pts[v_idx].x;
-			double north = ring.pts[v_idx].y;
-			double x, y;
-			georef.en2xy(east, north, &x, &y);
-			ring.pts[v_idx].x = x;
-			ring.pts[v_idx].y = y;
-		}
+		if(rings[r_idx].pts.empty()) continue;
+		georef.en2xy(rings[r_idx].pts);
 	}
 }
 
@@ -655,67 +653,88 @@ static double estimate_canvas_size_sq(const GeoRef &georef, double semi_major) {
 	return size;
 }
 
-void Mpoly::xy2ll_with_interp(const GeoRef &georef, double toler) {
-	size_t nrings = rings.size();
-	Mpoly ll_poly;
-	ll_poly.rings.resize(nrings);
-	
+// What xy2ll_with_interp needs in order to do a ring.
+struct XY2LLParams {
+	double toler;
 	double semi_major;
-	if(georef.have_semi_major) {
-		semi_major = georef.semi_major;
-	} else {
-		semi_major = 6370997.0;
-		fprintf(stderr, "Warning: could not get globe size, assuming %lf\n", semi_major);
+	double canvas_size_sq;
+	double epsilon;
+	double shrink;
+};
+
+// Transforms the given points from xy to ll, with the shrink kludge applied.
+static void shrunk_xy2ll_or_die(
+	const GeoRef &georef, const XY2LLParams &params,
+	const std::vector<Vertex> &xy, std::vector<Vertex> &ll
+) {
+	size_t n = xy.size();
+	std::vector<double> x(n), y(n), lon(n), lat(n);
+	for(size_t i=0; i<n; i++) {
+		x[i] = xy[i].x*params.shrink+params.epsilon;
+		y[i] = xy[i].y;
 	}
-	double canvas_size_sq = estimate_canvas_size_sq(georef, semi_major);
-	//printf("canvas_size_sq = %lf\n", canvas_size_sq);
-
-	// FIXME - now that we don't use ll2xy this is probably not needed:
-	// This is a kludge that shrinks the canvas by a millionth of a pixel
-	// to avoid problems with images that span an entire 360 degrees of
-	// longitude.  Without this the map xy -> ll -> xy is not single-valued.
-	double epsilon = 5e-7;
-	double shrink = ((double)georef.w - 2.0*epsilon) / (double)georef.w;
-
-	for(size_t r_idx=0; r_idx<nrings; r_idx++) {
-		// note that this is *not* a reference, since it will potentially
-		// be modified
-		Ring xy_ring = rings[r_idx];
-		// this will be the output
-		Ring &ll_ring = ll_poly.rings[r_idx];
-		ll_ring = xy_ring.copyMetadata();
-		ll_ring.pts.resize(xy_ring.pts.size());
-
-		for(size_t v_idx=0; v_idx<ll_ring.pts.size(); v_idx++) {
-			double x = xy_ring.pts[v_idx].x;
-			double y = xy_ring.pts[v_idx].y;
-			double lon, lat;
-			georef.xy2ll_or_die(x*shrink+epsilon, y, &lon, &lat);
-			ll_ring.pts[v_idx].x = lon;
-			ll_ring.pts[v_idx].y = lat;
-		}
-
-		int num_consec = 0;
-
-		for(size_t v_idx=0; v_idx<ll_ring.pts.size(); ) {
-			if(xy_ring.pts.size() != ll_ring.pts.size()) {
-				fatal_error("xy_ring.npts != ll_ring.npts");
-			}
-			size_t npts = xy_ring.pts.size();
+	ll.resize(n);
+	if(!n) return;
+	georef.xy2ll_or_die(n, &x[0], &y[0], &lon[0], &lat[0]);
+	for(size_t i=0; i<n; i++) {
+		ll[i] = Vertex(lon[i], lat[i]);
+	}
+}
 
-			const Vertex xy1 = xy_ring.pts[v_idx];
-			const Vertex xy2 = xy_ring.pts[(v_idx + 1) % npts];
+// Adds the points of a ring, along with any midpoints needed, to xy_out and
+// ll_out.  ll_in and ll_mid are the (shrunk) projections of the ring's points
+// and of the midpoints of its segments.
+static void subdivide_ring_for_xy2ll(
+	const GeoRef &georef, const XY2LLParams &params,
+	const Ring &xy_ring, size_t r_idx,
+	const Vertex *ll_in, const Vertex *ll_mid,
+	std::vector<Vertex> &xy_out, std::vector<Vertex> &ll_out
+) {
+	const double toler = params.toler;
+	const double semi_major = params.semi_major;
+	const double canvas_size_sq = params.canvas_size_sq;
+	const double epsilon = params.epsilon;
+	const double shrink = params.shrink;
+
+	const size_t npts_in = xy_ring.pts.size();
+	const size_t ring_begin = xy_out.size();
+
+	// Segments are split in two until each part is close enough to a
+	// straight line in ll.  These are the far ends of the parts yet to be
+	// checked, with the nearest last.
+	std::vector<Vertex> xy_pending, ll_pending;
+
+	int num_consec = 0;
+
+	for(size_t seg_idx=0; seg_idx<npts_in; seg_idx++) {
+		xy_out.push_back(xy_ring.pts[seg_idx]);
+		ll_out.push_back(ll_in[seg_idx]);
+		size_t next_idx = (seg_idx + 1) % npts_in;
+		xy_pending.push_back(xy_ring.pts[next_idx]);
+		// the first point has possibly been moved by 360 degrees by now
+		ll_pending.push_back(next_idx ? ll_in[next_idx] : ll_out[ring_begin]);
+		bool is_first_check = true;
+
+		while(!xy_pending.empty()) {
+			size_t v_idx = xy_out.size() - 1 - ring_begin;
+			const Vertex xy1 = xy_out.back();
+			const Vertex xy2 = xy_pending.back();
 			const Vertex xy_m(
 				(xy1.x + xy2.x)/2.0,
 				(xy1.y + xy2.y)/2.0);
 
 			Vertex ll_m_proj;
-			georef.xy2ll_or_die(
-				xy_m.x*shrink+epsilon, xy_m.y,
-				&ll_m_proj.x, &ll_m_proj.y);
+			if(is_first_check) {
+				ll_m_proj = ll_mid[seg_idx];
+				is_first_check = false;
+			} else {
+				georef.xy2ll_or_die(
+					xy_m.x*shrink+epsilon, xy_m.y,
+					&ll_m_proj.x, &ll_m_proj.y);
+			}
 
-			Vertex &ll1 = ll_ring.pts[v_idx];
-			Vertex &ll2 = ll_ring.pts[(v_idx + 1) % npts];
+			Vertex &ll1 = ll_out.back();
+			Vertex &ll2 = ll_pending.back();
 
 			while(ll1.x - ll2.x >  180) ll1.x -= 360;
 			while(ll1.x - ll2.x < -180) ll1.x += 360;
@@ -789,27 +808,188 @@ void Mpoly::xy2ll_with_interp(const GeoRef &georef, double toler) {
 					printf("    midxy=[%lf,%lf] midll=[%lf,%lf]\n", 
 						xy_m.x, xy_m.y, ll_m_proj.x, ll_m_proj.y);
 				}
-				xy_ring.pts.insert(xy_ring.pts.begin()+v_idx+1, xy_m);
-				ll_ring.pts.insert(ll_ring.pts.begin()+v_idx+1, ll_m_proj);
+				xy_pending.push_back(xy_m);
+				ll_pending.push_back(ll_m_proj);
 			} else {
-				v_idx++;
+				Vertex xy_next = xy_pending.back();
+				Vertex ll_next = ll_pending.back();
+				xy_pending.pop_back();
+				ll_pending.pop_back();
+				// The end of the input segment gets added as the start of
+				// the next one.
+				if(!xy_pending.empty()) {
+					xy_out.push_back(xy_next);
+					ll_out.push_back(ll_next);
+				}
 				num_consec = 0;
 			}
 		}
+	}
+}
+
+// Does xy2ll_with_interp for rings begin through end-1 of in, putting the
+// results in the same slots of out.  The projections are done for all of
+// these rings at once as far as possible.
+static void rings_xy2ll_with_interp(
+	const GeoRef &georef, const XY2LLParams &params,
+	const Mpoly &in, size_t begin, size_t end, Mpoly &out
+) {
+	// Every point gets projected, and every segment gets its midpoint
+	// checked at least once, so these are all done up front.  For each ring
+	// this holds the points followed by the midpoints.
+	std::vector<Vertex> xy_first, ll_first;
+	for(size_t r_idx=begin; r_idx<end; r_idx++) {
+		const Ring &xy_ring = in.rings[r_idx];
+		size_t npts_in = xy_ring.pts.size();
+		xy_first.insert(xy_first.end(), xy_ring.pts.begin(), xy_ring.pts.end());
+		for(size_t v_idx=0; v_idx<npts_in; v_idx++) {
+			const Vertex xy1 = xy_ring.pts[v_idx];
+			const Vertex xy2 = xy_ring.pts[(v_idx + 1) % npts_in];
+			xy_first.push_back(Vertex(
+				(xy1.x + xy2.x)/2.0,
+				(xy1.y + xy2.y)/2.0));
+		}
+	}
+	shrunk_xy2ll_or_die(georef, params, xy_first, ll_first);
+
+	// The points of the output rings, one after the other.
+	std::vector<Vertex> xy_out, ll_out;
+	xy_out.reserve(xy_first.size() / 2);
+	ll_out.reserve(xy_first.size() / 2);
+	std::vector<size_t> out_begin;
+	size_t first_idx = 0;
+	for(size_t r_idx=begin; r_idx<end; r_idx++) {
+		const Ring &xy_ring = in.rings[r_idx];
+		size_t npts_in = xy_ring.pts.size();
+		out_begin.push_back(xy_out.size());
+		if(npts_in) {
+			subdivide_ring_for_xy2ll(georef, params, xy_ring, r_idx,
+				&ll_first[first_idx], &ll_first[first_idx + npts_in],
+				xy_out, ll_out);
+		}
+		first_idx += 2*npts_in;
+	}
+	out_begin.push_back(xy_out.size());
+
+	// Now reproject everything again, without using the shrink
+	// kludge.  We no longer care whether the projection is
+	// single-valued and we don't want the loss of accuracy
+	// that comes from multiplying by shrink.
+	size_t npts_out = xy_out.size();
+	std::vector<double> x(npts_out), y(npts_out), lon(npts_out), lat(npts_out);
+	for(size_t v_idx=0; v_idx<npts_out; v_idx++) {
+		x[v_idx] = xy_out[v_idx].x;
+		y[v_idx] = xy_out[v_idx].y;
+	}
+	if(npts_out) {
+		georef.xy2ll_or_die(npts_out, &x[0], &y[0], &lon[0], &lat[0]);
+	}
+
+	for(size_t r_idx=begin; r_idx<end; r_idx++) {
+		Ring &ll_ring = out.rings[r_idx];
+		ll_ring = in.rings[r_idx].copyMetadata();
+		size_t o_begin = out_begin[r_idx - begin];
+		size_t o_end = out_begin[r_idx - begin + 1];
+		ll_ring.pts.resize(o_end - o_begin);
+		for(size_t v_idx=o_begin; v_idx<o_end; v_idx++) {
+			ll_ring.pts[v_idx - o_begin].x = lon[v_idx];
+			ll_ring.pts[v_idx - o_begin].y = lat[v_idx];
+		}
+	}
+}
+
+// Rings are projected several at a time, so as to make fewer, bigger calls
+// to OCTTransform.  This gives the end of a group of rings starting at begin.
+static size_t get_xy2ll_batch_end(const Mpoly &in, size_t begin) {
+	const size_t min_batch_pts = 4096;
+	size_t end = begin;
+	size_t batch_pts = 0;
+	while(end < in.rings.size() && (end == begin || batch_pts < min_batch_pts)) {
+		batch_pts += in.rings[end].pts.size();
+		end++;
+	}
+	return end;
+}
 
-		// Now reproject everything again, without using the shrink
-		// kludge.  We no longer care whether the projection is
-		// single-valued and we don't want the loss of accuracy
-		// that comes from multiplying by shrink.
-		for(size_t v_idx=0; v_idx<ll_ring.pts.size(); v_idx++) {
-			double x = xy_ring.pts[v_idx].x;
-			double y = xy_ring.pts[v_idx].y;
+// Rings waiting for xy2ll_with_interp, shared between threads.  Each ring's
+// output goes in its own slot.
+struct XY2LLQueue {
+	XY2LLQueue(const Mpoly &_in, const XY2LLParams &_params, Mpoly &_out) :
+		in(_in), params(_params), out(_out), next(0) { }
+
+	const Mpoly &in;
+	const XY2LLParams &params;
+	Mpoly &out;
+
+	// guards next
+	boost::mutex lock;
+	size_t next;
+};
+
+static void xy2ll_worker(XY2LLQueue *q, const GeoRef *georef) {
+	for(;;) {
+		size_t begin, end;
+		{
+			boost::mutex::scoped_lock l(q->lock);
+			begin = q->next;
+			end = get_xy2ll_batch_end(q->in, begin);
+			q->next = end;
+		}
+		if(begin == end) break;
+		rings_xy2ll_with_interp(*georef, q->params, q->in, begin, end, q->out);
+	}
+}
+
+void Mpoly::xy2ll_with_interp(const GeoRef &georef, double toler, int num_threads) {
+	size_t nrings = rings.size();
+	Mpoly ll_poly;
+	ll_poly.rings.resize(nrings);
+	
+	double semi_major;
+	if(georef.have_semi_major) {
+		semi_major = georef.semi_major;
+	} else {
+		semi_major = 6370997.0;
+		fprintf(stderr, "Warning: could not get globe size, assuming %lf\n", semi_major);
+	}
+	double canvas_size_sq = estimate_canvas_size_sq(georef, semi_major);
+	//printf("canvas_size_sq = %lf\n", canvas_size_sq);
 
-			double lon, lat;
-			georef.xy2ll_or_die(x, y, &lon, &lat);
+	// FIXME - now that we don't use ll2xy this is probably not needed:
+	// This is a kludge that shrinks the canvas by a millionth of a pixel
+	// to avoid problems with images that span an entire 360 degrees of
+	// longitude.  Without this the map xy -> ll -> xy is not single-valued.
+	double epsilon = 5e-7;
+	double shrink = ((double)georef.w - 2.0*epsilon) / (double)georef.w;
 
-			ll_ring.pts[v_idx].x = lon;
-			ll_ring.pts[v_idx].y = lat;
+	XY2LLParams params;
+	params.toler = toler;
+	params.semi_major = semi_major;
+	params.canvas_size_sq = canvas_size_sq;
+	params.epsilon = epsilon;
+	params.shrink = shrink;
+
+	size_t num_workers = std::min(size_t(std::max(num_threads, 1)), nrings);
+	if(num_workers > 1) {
+		XY2LLQueue q(*this, params, ll_poly);
+		std::vector<GeoRef> worker_georefs;
+		for(size_t i=1; i<num_workers; i++) {
+			worker_georefs.push_back(georef.withOwnTransforms());
+		}
+		boost::thread_group threads;
+		for(size_t i=1; i<num_workers; i++) {
+			threads.add_thread(new boost::thread(xy2ll_worker, &q, &worker_georefs[i-1]));
+		}
+		xy2ll_worker(&q, &georef);
+		threads.join_all();
+		for(size_t i=0; i<worker_georefs.size(); i++) {
+			worker_georefs[i].destroyTransforms();
+		}
+	} else {
+		for(size_t begin=0; begin<nrings; ) {
+			size_t end = get_xy2ll_batch_end(*this, begin);
+			rings_xy2ll_with_interp(georef, params, *this, begin, end, ll_poly);
+			begin = end;
 		}
 	}
 
@@ -113,138 +113,187 @@ static inline bool is_disjoint(const Bbox &bb1, const Bbox &bb2) {
 		bb2.min_y >  bb1.max_y;
 }
 
-// BboxBinarySpacePartition helps you quickly find which of a list of items (that have bounding
-// boxes) intersect a given bounding box.  Think of it as a std::map whose keys are bounding
-// boxes.  Since several items may intersect a given query box, query returns a list of
-// matches.
+// BboxRTree helps you quickly find which of a list of items (that have bounding boxes)
+// intersect a given bounding box.  Think of it as a std::map whose keys are bounding boxes.
+// Since several items may intersect a given query box, query returns a list of matches.
 //
-// When many object have overlapping bbox, this tree may not be so efficient and maybe
-// something better should be cooked up if it turns out to be slow.
+// The tree is built once and can't be changed afterwards.  Items are packed into nodes of
+// node_size, and those into parent nodes, and so on up to the root, with every node but the
+// last of each level being full.  This way the children of a node can be found from its
+// index, and every level is stored in one array, so that building the tree makes just a few
+// allocations and a query makes none, other than what the caller does with the results.
+// Which items go together is decided from the top down: the items are split into vertical
+// slices and each slice into tiles, one per child of the root, and then the same is done
+// within each tile (this is known as sort-tile-recursive packing).
 template <typename T>
-class BboxBinarySpacePartition {
+class BboxRTree {
 public:
-	BboxBinarySpacePartition(
-		std::vector<std::pair<Bbox, T> > items,
-		size_t max_leaf_size = 20,
-		bool axis = 0
+	BboxRTree(
+		const std::vector<std::pair<Bbox, T> > &items,
+		size_t _node_size = 8
 	) :
-		left(NULL),
-		right(NULL)
+		node_size(std::max(_node_size, size_t(2)))
 	{
-		leaf_items = items;
-
-		// Compute bbox containing all items.
+		// Items with empty bbox never intersect anything, so leave them out.
+		std::vector<Entry> order;
 		for(size_t i=0; i<items.size(); i++) {
-			node_bbox.expand(items[i].first);
+			const Bbox &ibb = items[i].first;
+			if(ibb.empty) continue;
+			Entry e;
+			e.mid_x = (ibb.min_x + ibb.max_x) / 2.0;
+			e.mid_y = (ibb.min_y + ibb.max_y) / 2.0;
+			e.idx = i;
+			order.push_back(e);
+		}
+		if(order.empty()) return;
+
+		size_t child_cap = 1;
+		while(child_cap * node_size < order.size()) child_cap *= node_size;
+		sort_tiles(order, 0, order.size(), child_cap);
+
+		// Count the nodes so that everything can be allocated up front.
+		size_t num_nodes = 0;
+		for(size_t n=order.size(); ; n=(n+node_size-1)/node_size) {
+			level_begin.push_back(num_nodes);
+			num_nodes += n;
+			if(n == 1) break;
+		}
+		level_begin.push_back(num_nodes);
+		nodes.resize(num_nodes);
+
+		leaf_items.reserve(order.size());
+		for(size_t i=0; i<order.size(); i++) {
+			const std::pair<Bbox, T> &item = items[order[i].idx];
+			nodes[i] = Node(item.first);
+			leaf_items.push_back(item.second);
 		}
 
-		if(items.size() > max_leaf_size) {
-			subdivide(max_leaf_size, axis);
+		for(size_t level=1; level+1 < level_begin.size(); level++) {
+			size_t child_begin = level_begin[level-1];
+			size_t child_end = level_begin[level];
+			for(size_t i=level_begin[level]; i<level_begin[level+1]; i++) {
+				size_t c = child_begin + (i-level_begin[level]) * node_size;
+				Node &node = nodes[i];
+				node = nodes[c];
+				for(size_t c_end=std::min(c+node_size, child_end); c<c_end; c++) {
+					node.expand(nodes[c]);
+				}
+			}
 		}
 	}
 
-	~BboxBinarySpacePartition() {
-		delete(left);
-		delete(right);
+	// Calls visitor(item) for each item whose bbox intersects needle.
+	template <typename Visitor>
+	void visit_intersecting_items(const Bbox &needle, Visitor &visitor) const {
+		if(nodes.empty() || needle.empty) return;
+		Node n(needle);
+		visit_node(level_begin.size()-2, nodes.size()-1, n, visitor);
 	}
 
-	std::vector<T> get_intersecting_items(Bbox needle) const {
+	std::vector<T> get_intersecting_items(const Bbox &needle) const {
 		std::vector<T> ret;
-		append_intersecting_items(ret, needle);
+		Appender appender(ret);
+		visit_intersecting_items(needle, appender);
 		return ret;
 	}
 
 private:
-	void append_intersecting_items(
-		std::vector<T> &out,
-		Bbox needle
-	) const {
-		if(left) {
-			assert(right);
-			if(!is_disjoint(needle, left->node_bbox)) {
-				left ->append_intersecting_items(out, needle);
-			}
-			if(!is_disjoint(needle, right->node_bbox)) {
-				right->append_intersecting_items(out, needle);
-			}
-		} else {
-			for(size_t i=0; i<leaf_items.size(); i++) {
-				if(!is_disjoint(needle, leaf_items[i].first)) {
-					out.push_back(leaf_items[i].second);
-				}
+	struct Node {
+		Node() { }
+		explicit Node(const Bbox &bb) :
+			min_x(bb.min_x), min_y(bb.min_y), max_x(bb.max_x), max_y(bb.max_y) { }
+
+		void expand(const Node &o) {
+			min_x = std::min(min_x, o.min_x);
+			min_y = std::min(min_y, o.min_y);
+			max_x = std::max(max_x, o.max_x);
+			max_y = std::max(max_y, o.max_y);
+		}
+
+		bool is_disjoint(const Node &o) const {
+			return
+				min_x > o.max_x || min_y > o.max_y ||
+				o.min_x > max_x || o.min_y > max_y;
+		}
+
+		double min_x, min_y, max_x, max_y;
+	};
+
+	struct Entry {
+		double mid_x, mid_y;
+		size_t idx;
+	};
+
+	static bool entry_x_less(const Entry &a, const Entry &b) { return a.mid_x < b.mid_x; }
+	static bool entry_y_less(const Entry &a, const Entry &b) { return a.mid_y < b.mid_y; }
+
+	// Reorders entries [begin, end) so that each run of run_size of them comes before the
+	// next in the given ordering.  Within a run they are left in no particular order, which
+	// is cheaper than sorting them.
+	static void split_runs(
+		std::vector<Entry> &order, size_t begin, size_t end, size_t run_size,
+		bool (*less)(const Entry &, const Entry &)
+	) {
+		size_t num_runs = (end - begin + run_size - 1) / run_size;
+		if(num_runs < 2) return;
+		size_t mid = begin + (num_runs / 2) * run_size;
+		std::nth_element(order.begin()+begin, order.begin()+mid, order.begin()+end, less);
+		split_runs(order, begin, mid, run_size, less);
+		split_runs(order, mid, end, run_size, less);
+	}
+
+	// Orders entries [begin, end) so that each run of child_cap of them is a compact group,
+	// and likewise within each run, down to the leaves.
+	void sort_tiles(std::vector<Entry> &order, size_t begin, size_t end, size_t child_cap) const {
+		if(child_cap == 1) return;
+		size_t num_children = (end - begin + child_cap - 1) / child_cap;
+		size_t num_slices = size_t(ceil(sqrt(double(num_children))));
+		size_t slice_size = num_slices * child_cap;
+		split_runs(order, begin, end, slice_size, entry_x_less);
+		for(size_t slice=begin; slice<end; slice+=slice_size) {
+			size_t slice_end = std::min(slice+slice_size, end);
+			split_runs(order, slice, slice_end, child_cap, entry_y_less);
+			for(size_t tile=slice; tile<slice_end; tile+=child_cap) {
+				sort_tiles(order, tile, std::min(tile+child_cap, slice_end), child_cap/node_size);
 			}
 		}
 	}
 
-	void subdivide(size_t max_leaf_size, bool axis) {
-		std::vector<double> midpts(leaf_items.size());
-		double cmin = 0, cmax = 0, cavg = 0;
-		size_t num_nonempty = 0;
-		for(size_t i=0; i<leaf_items.size(); i++) {
-			const Bbox &ibb = leaf_items[i].first;
-			if(ibb.empty) continue;
-			num_nonempty++;
-			node_bbox.expand(ibb);
-			double item_mid = axis ?
-				(ibb.min_y + ibb.max_y) / 2.0 :
-				(ibb.min_x + ibb.max_x) / 2.0;
-			if(i == 0) cmin = cmax = item_mid;
-			cmin = std::min(cmin, item_mid);
-			cmax = std::max(cmax, item_mid);
-			cavg += item_mid;
+	struct Appender {
+		explicit Appender(std::vector<T> &_out) : out(_out) { }
+		void operator()(const T &item) { out.push_back(item); }
+		std::vector<T> &out;
+	};
+
+	template <typename Visitor>
+	void visit_node(size_t level, size_t idx, const Node &needle, Visitor &visitor) const {
+		if(nodes[idx].is_disjoint(needle)) return;
+		if(level == 0) {
+			visitor(leaf_items[idx]);
+			return;
 		}
-		cavg /= num_nonempty;
-
-		// Subdivide space into two halves.  Note: this is used to decide which branch of the
-		// tree each item goes into.  However, each branch will then compute the exact Bbox
-		// that contains each of its items (it won't use these ones we compute here).
-		Bbox left_bbox, right_bbox;
-		if(axis) {
-			left_bbox = Bbox(
-				node_bbox.min_x, node_bbox.max_x,
-				cmin, cavg);
-			right_bbox = Bbox(
-				node_bbox.min_x, node_bbox.max_x,
-				cavg, cmax);
+		size_t c = level_begin[level-1] + (idx - level_begin[level]) * node_size;
+		size_t c_end = std::min(c + node_size, level_begin[level]);
+		if(level == 1) {
+			// leaf level done here to save a function call per item
+			for(; c<c_end; c++) {
+				if(!nodes[c].is_disjoint(needle)) visitor(leaf_items[c]);
+			}
 		} else {
-			left_bbox = Bbox(
-				cmin, cavg,
-				node_bbox.min_y, node_bbox.max_y);
-			right_bbox = Bbox(
-				cavg, cmax,
-				node_bbox.min_y, node_bbox.max_y);
-		}
-
-		// Find which items go in each box.
-		//
-		// Note: it would be possible to just move items to the left and right side of the
-		// original array like with quicksort, and never have to allocate all of these little
-		// vectors for every node.
-		std::vector<std::pair<Bbox, T> > left_items, right_items;
-		for(size_t i=0; i<leaf_items.size(); i++) {
-			const Bbox &ibb = leaf_items[i].first;
-			Vertex item_mid = Vertex(
-				(ibb.min_x + ibb.max_x) / 2.0,
-				(ibb.min_y + ibb.max_y) / 2.0);
-			if(left_bbox.contains(item_mid)) {
-				left_items.push_back(leaf_items[i]);
-			} else {
-				right_items.push_back(leaf_items[i]);
+			for(; c<c_end; c++) {
+				visit_node(level-1, c, needle, visitor);
 			}
 		}
-
-		// free memory
-		leaf_items.clear();
-
-		left  = new BboxBinarySpacePartition<T>(left_items,  max_leaf_size, !axis);
-		right = new BboxBinarySpacePartition<T>(right_items, max_leaf_size, !axis);
 	}
 
-private:
-	Bbox node_bbox;
-	BboxBinarySpacePartition<T> *left, *right;
-	// only used by leafs
-	std::vector<std::pair<Bbox, T> > leaf_items;
+	size_t node_size;
+	// The nodes of each level, leaves (one per item) first and the root last.  Node i of a
+	// level has as children nodes i*node_size through (i+1)*node_size-1 of the level below.
+	std::vector<Node> nodes;
+	// index of the first node of each level, plus one past the end
+	std::vector<size_t> level_begin;
+	// the items, in the same order as the leaf nodes
+	std::vector<T> leaf_items;
 };
 
 class Ring {
@@ -284,9 +333,12 @@ public:
 	bool component_contains(Vertex p, int outer_ring_id) const;
 	void deleteRing(size_t idx);
 
+	void translate(double dx, double dy);
 	void xy2en(const GeoRef &georef);
 	void en2xy(const GeoRef &georef);
-	void xy2ll_with_interp(const GeoRef &georef, double toler);
+	// With num_threads > 1, the rings are done in that many threads.  The
+	// output is the same either way.
+	void xy2ll_with_interp(const GeoRef &georef, double toler, int num_threads=1);
 
 	void debug_dump_binary(FILE *fh) const;
 	static Mpoly debug_load_binary(FILE *fh);
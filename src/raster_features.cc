@@ -26,9 +26,13 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 
 
 
+#include <algorithm>
+#include <cstring>
+
 #include <boost/foreach.hpp>
 
 #include "raster_features.h"
+#include "mask-tracer.h"
 
 namespace dangdal {
 
@@ -212,25 +216,92 @@ void FeatureInterpreter::set_ogr_fields(OGRLayerH ogr_layer, OGRFeatureH ogr_fea
 	}
 }
 
+RawValIndex::RawValIndex(size_t _val_size) :
+	val_size(_val_size), num_vals(0), slots(64, 0)
+{ }
+
+uint64_t RawValIndex::hash(const uint8_t *val) const {
+	uint64_t hv = 0xcbf29ce484222325ULL;
+	for(size_t i=0; i<val_size; i+=8) {
+		uint64_t word = 0;
+		memcpy(&word, val+i, std::min(size_t(8), val_size-i));
+		hv = (hv ^ word) * 0x9e3779b97f4a7c15ULL;
+		hv ^= hv >> 29;
+	}
+	return hv;
+}
+
+size_t RawValIndex::find(const uint8_t *val, size_t &slot) const {
+	size_t slot_mask = slots.size() - 1;
+	slot = hash(val) & slot_mask;
+	for(;;) {
+		uint32_t s = slots[slot];
+		if(!s) return num_vals;
+		if(!memcmp(value(s-1), val, val_size)) return s-1;
+		slot = (slot + 1) & slot_mask;
+	}
+}
+
+void RawValIndex::add(const uint8_t *val, size_t slot) {
+	vals.insert(vals.end(), val, val+val_size);
+	slots[slot] = ++num_vals;
+	// keep the table at most half full
+	if(num_vals * 2 > slots.size()) grow();
+}
+
+void RawValIndex::grow() {
+	std::vector<uint32_t>(slots.size() * 2, 0).swap(slots);
+	size_t slot_mask = slots.size() - 1;
+	for(size_t idx=0; idx<num_vals; idx++) {
+		size_t slot = hash(value(idx)) & slot_mask;
+		while(slots[slot]) slot = (slot + 1) & slot_mask;
+		slots[slot] = idx+1;
+	}
+}
+
 FeatureBitmap::FeatureBitmap(const size_t _w, const size_t _h, const size_t _raw_vals_size) :
 	w(_w), h(_h),
 	raw_vals_size(_raw_vals_size),
-	raster(w, h)
+	num_ndv(0),
+	wide(false),
+	raster16(w, h),
+	raster32(0, 0),
+	index(_raw_vals_size)
 { }
 
+void FeatureBitmap::widen() {
+	if(VERBOSE) printf("more than 65536 feature values, switching to 32 bit indices\n");
+	raster32 = GridArray<uint32_t>(w, h);
+	for(size_t y=0; y<h; y++) {
+		const uint16_t *in = &raster16(0, y);
+		uint32_t *out = &raster32(0, y);
+		std::copy(in, in+w, out);
+	}
+	raster16 = GridArray<uint16_t>(0, 0);
+	wide = true;
+}
+
 FeatureBitmap::Index FeatureBitmap::get_index(const FeatureRawVal &pixel) {
-	std::map<FeatureRawVal, Index>::iterator it = table.find(pixel);
-	if(it == table.end()) {
-		if(table.size() >= std::numeric_limits<FeatureBitmap::Index>::max()) {
+	assert(pixel.size() == raw_vals_size);
+	return get_index(&pixel[0]);
+}
+
+FeatureBitmap::Index FeatureBitmap::get_index(const uint8_t *raw_val) {
+	size_t slot;
+	size_t idx = index.find(raw_val, slot);
+	if(idx == index.size()) {
+		if(idx >= std::numeric_limits<FeatureBitmap::Index>::max()) {
 			fatal_error("Input had too many feature values (max is %zd)",
 				size_t(std::numeric_limits<FeatureBitmap::Index>::max()));
 		}
-		FeatureBitmap::Index v = table.size();
-		table[pixel] = v;
-		return v;
-	} else {
-		return it->second;
+		if(!wide && idx > std::numeric_limits<uint16_t>::max()) widen();
+		index.add(raw_val, slot);
+		stats.push_back(FeatureStats());
+		FeatureRawVal pixel;
+		pixel.assign(raw_val, raw_val + raw_vals_size);
+		table[pixel] = idx;
 	}
+	return idx;
 }
 
 void FeatureBitmap::dump_feature_table() const {
@@ -241,22 +312,73 @@ void FeatureBitmap::dump_feature_table() const {
 			if(i) printf(",");
 			printf(" %d", f.first[i]);
 		}
-		printf("\n");
+		const FeatureStats &st = stats[f.second];
+		printf(" (%zd pixels in %d,%d .. %d,%d)\n", st.num_pixels,
+			st.min_x, st.min_y, st.max_x, st.max_y);
 	}
 }
 
 BitGrid FeatureBitmap::get_mask_for_feature(FeatureBitmap::Index wanted) const {
-	BitGrid mask(w, h);
+	return get_mask_for_window(wanted, 0, 0, w, h);
+}
 
-	for(size_t y=0; y<h; y++) {
-		for(size_t x=0; x<w; x++) {
-			mask.set(x, y, raster(x, y) == wanted);
+BitGrid FeatureBitmap::get_cropped_mask_for_feature(
+	FeatureBitmap::Index wanted, int *off_x, int *off_y
+) const {
+	const FeatureStats &st = stats[wanted];
+	// The bounding box of feature 0 doesn't cover the NDV pixels.
+	if(!st.num_pixels || (wanted == 0 && num_ndv)) {
+		*off_x = *off_y = 0;
+		return get_mask_for_feature(wanted);
+	}
+
+	*off_x = st.min_x;
+	*off_y = st.min_y;
+	return get_mask_for_window(wanted, st.min_x, st.min_y,
+		st.max_x - st.min_x + 1, st.max_y - st.min_y + 1);
+}
+
+template <typename T>
+static BitGrid mask_for_window(
+	const GridArray<T> &raster, T wanted, int x0, int y0, int mask_w, int mask_h
+) {
+	BitGrid mask(mask_w, mask_h);
+
+	for(int y=0; y<mask_h; y++) {
+		const T *row = &raster(x0, y0+y);
+		for(int x=0; x<mask_w; x++) {
+			if(row[x] == wanted) mask.set(x, y, true);
 		}
 	}
 
 	return mask;
 }
 
+BitGrid FeatureBitmap::get_mask_for_window(
+	FeatureBitmap::Index wanted, int x0, int y0, int mask_w, int mask_h
+) const {
+	if(wide) {
+		return mask_for_window(raster32, wanted, x0, y0, mask_w, mask_h);
+	} else {
+		return mask_for_window(raster16, uint16_t(wanted), x0, y0, mask_w, mask_h);
+	}
+}
+
+std::vector<Mpoly> FeatureBitmap::trace_features(int64_t min_area, int num_threads) const {
+	// The tracer also has to get through the NDV pixels, which are in feature 0.
+	std::vector<size_t> sizes(index.size());
+	for(size_t i=0; i<sizes.size(); i++) {
+		sizes[i] = stats[i].num_pixels;
+	}
+	if(!sizes.empty()) sizes[0] += num_ndv;
+
+	if(wide) {
+		return trace_classes(raster32, w, h, sizes, min_area, num_threads);
+	} else {
+		return trace_classes(raster16, w, h, sizes, min_area, num_threads);
+	}
+}
+
 FeatureBitmap *FeatureBitmap::from_raster(
 	GDALDatasetH ds, std::vector<size_t> band_ids, const NdvDef &ndv_def, DebugPlot *dbuf
 ) {
@@ -305,15 +427,33 @@ FeatureBitmap *FeatureBitmap::from_raster(
 	if(VERBOSE >= 2) printf("\n");
 
 	std::vector<std::vector<uint8_t> > band_buf(bands.size());
+	std::vector<const void *> band_p(bands.size());
 	for(size_t i=0; i<bands.size(); i++) {
 		size_t num_bytes = blocksize_xy * dt_sizes[i];
 		band_buf[i].resize(num_bytes);
+		band_p[i] = &band_buf[i][0];
 	}
 
 	std::vector<uint8_t> ndv_mask(blocksize_xy);
+	boost::shared_ptr<const NdvPredicate> ndv_pred = ndv_def.compile(datatypes);
 
 	FeatureBitmap *fbm = new FeatureBitmap(w, h, dt_total_size);
 
+	// A single band of 8 or 16 bit values needs no hashing: the value itself
+	// indexes a table of feature indices.  This is the usual case (paletted
+	// or classified rasters).
+	const FeatureBitmap::Index no_index = std::numeric_limits<FeatureBitmap::Index>::max();
+	std::vector<FeatureBitmap::Index> remap;
+	if(bands.size() == 1 && datatypes[0] == GDT_Byte) remap.resize(256, no_index);
+	if(bands.size() == 1 && datatypes[0] == GDT_UInt16) remap.resize(65536, no_index);
+
+	// The raw value of the current pixel, and of the last valid one.  Runs
+	// of the same value are common, and needn't be looked up each time.
+	std::vector<uint8_t> pixel(dt_total_size);
+	std::vector<uint8_t> prev_pixel(dt_total_size);
+	FeatureBitmap::Index prev_index = 0;
+	bool have_prev = false;
+
 	size_t num_valid = 0;
 	size_t num_ndv = 0;
 
@@ -341,11 +481,37 @@ FeatureBitmap *FeatureBitmap::from_raster(
 				GDALReadBlock(bands[band_idx], block_x, block_y, &band_buf[band_idx][0]);
 			}
 			if(!ndv_def.empty()) {
-				ndv_def.getNdvMask(band_buf, datatypes, &ndv_mask[0], blocksize_xy);
+				ndv_pred->getNdvMask(band_p, &ndv_mask[0], blocksize_xy);
 			}
 
-			FeatureRawVal pixel;
-			pixel.resize(dt_total_size);
+			if(!remap.empty() && !dbuf) {
+				const uint8_t *in8 = &band_buf[0][0];
+				const uint16_t *in16 = reinterpret_cast<const uint16_t *>(&band_buf[0][0]);
+				bool is_byte = datatypes[0] == GDT_Byte;
+				// a single 8 or 16 bit band can't have more than 65536 values
+				assert(!fbm->wide);
+				for(size_t sub_y=0; sub_y<bsize_y; sub_y++) {
+					int y = sub_y + boff_y;
+					// rows of the raster are contiguous, even if it is tiled
+					uint16_t *out = &fbm->raster16(boff_x, y);
+					for(size_t sub_x=0; sub_x<bsize_x; sub_x++) {
+						size_t in_idx = blocksize_x*sub_y + sub_x;
+						if(ndv_mask[in_idx]) {
+							num_ndv++;
+							continue;
+						}
+						num_valid++;
+						size_t v = is_byte ? in8[in_idx] : in16[in_idx];
+						FeatureBitmap::Index index_val = remap[v];
+						if(index_val == no_index) {
+							index_val = remap[v] = fbm->get_index(&band_buf[0][in_idx*dt_total_size]);
+						}
+						out[sub_x] = uint16_t(index_val);
+						fbm->stats[index_val].add_pixel(boff_x + sub_x, y);
+					}
+				}
+				continue;
+			}
 
 			for(size_t sub_y=0; sub_y<bsize_y; sub_y++) {
 				size_t y = sub_y + boff_y;
@@ -366,17 +532,31 @@ FeatureBitmap *FeatureBitmap::from_raster(
 					} else {
 						num_valid++;
 
-						size_t j = 0;
-						for(size_t band_id=0; band_id<bands.size(); band_id++) {
-							uint8_t *p = &band_buf[band_id][in_idx*dt_sizes[band_id]];
-							for(size_t i=0; i<dt_sizes[band_id]; i++) {
-								pixel[j++] = *(p++);
+						const uint8_t *raw_val;
+						if(bands.size() == 1) {
+							raw_val = &band_buf[0][in_idx*dt_total_size];
+						} else {
+							size_t j = 0;
+							for(size_t band_id=0; band_id<bands.size(); band_id++) {
+								memcpy(&pixel[j], &band_buf[band_id][in_idx*dt_sizes[band_id]],
+									dt_sizes[band_id]);
+								j += dt_sizes[band_id];
 							}
+							assert(j == dt_total_size);
+							raw_val = &pixel[0];
 						}
-						assert(j == dt_total_size);
 
-						FeatureBitmap::Index index_val = fbm->get_index(pixel);
-						fbm->raster(x, y) = index_val;
+						FeatureBitmap::Index index_val;
+						if(have_prev && !memcmp(raw_val, &prev_pixel[0], dt_total_size)) {
+							index_val = prev_index;
+						} else {
+							index_val = fbm->get_index(raw_val);
+							memcpy(&prev_pixel[0], raw_val, dt_total_size);
+							prev_index = index_val;
+							have_prev = true;
+						}
+						fbm->set_pixel(x, y, index_val);
+						fbm->stats[index_val].add_pixel(x, y);
 
 						if(is_dbuf_stride) {
 							size_t x = sub_x + boff_x;
@@ -394,6 +574,8 @@ FeatureBitmap *FeatureBitmap::from_raster(
 
 	GDALTermProgress(1, NULL, NULL);
 
+	fbm->num_ndv = num_ndv;
+
 	printf("Found %zd valid and %zd NDV pixels.\n", num_valid, num_ndv);
 
 	return fbm;
@@ -32,6 +32,7 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 // pixel value.  Also, the pixel values can be formatted as strings or as fields in an OGR
 // file.
 
+#include <algorithm>
 #include <vector>
 #include <map>
 #include <utility>
@@ -44,6 +45,7 @@ This code was developed by Dan Stahlke for the Geographic Information Network of
 
 #include "common.h"
 #include "mask.h"
+#include "polygon.h"
 #include "debugplot.h"
 #include "datatype_conversion.h"
 
@@ -90,10 +92,62 @@ private:
 	std::vector<BandInfo> band_info_list;
 };
 
-// A bitmap of features.  Features are stored as type Index in a bitmap, and can be mapped to
-// FeatureRawVal.
+// Assigns indices 0, 1, 2, ... to raw pixel values of a fixed size, in the
+// order they are first seen.  This is an open addressing hash table with the
+// values themselves stored end to end in one array, so that looking up a value
+// that has already been seen doesn't allocate anything.
+class RawValIndex {
+public:
+	explicit RawValIndex(size_t _val_size);
+
+	// Returns the index of the value, or the number of values seen so far
+	// (which is what the index will be if the value gets added).
+	size_t find(const uint8_t *val, size_t &slot) const;
+
+	// Adds a value which find said was not present, giving it the next index.
+	void add(const uint8_t *val, size_t slot);
+
+	size_t size() const { return num_vals; }
+
+	const uint8_t *value(size_t idx) const { return &vals[idx * val_size]; }
+
+private:
+	uint64_t hash(const uint8_t *val) const;
+	void grow();
+
+	size_t val_size;
+	size_t num_vals;
+	std::vector<uint8_t> vals;
+	// the index of the value in each slot plus one, or zero if empty
+	std::vector<uint32_t> slots;
+};
+
+// The number of pixels of a feature and the smallest rectangle holding them (inclusive pixel
+// coordinates, with min > max if there are no pixels).
+struct FeatureStats {
+	FeatureStats() :
+		num_pixels(0),
+		min_x(std::numeric_limits<int>::max()), min_y(std::numeric_limits<int>::max()),
+		max_x(-1), max_y(-1)
+	{ }
+
+	void add_pixel(int x, int y) {
+		num_pixels++;
+		min_x = std::min(min_x, x);
+		min_y = std::min(min_y, y);
+		max_x = std::max(max_x, x);
+		max_y = std::max(max_y, y);
+	}
+
+	size_t num_pixels;
+	int min_x, min_y, max_x, max_y;
+};
+
+// A bitmap of features.  Features are stored by index in a bitmap, and can be mapped to
+// FeatureRawVal.  The bitmap holds 16 bit indices, and is switched to 32 bits if more than
+// 65536 distinct values turn up.
 struct FeatureBitmap {
-	typedef uint16_t Index;
+	typedef uint32_t Index;
 
 	FeatureBitmap(const size_t _w, const size_t _h, const size_t _raw_vals_size);
 
@@ -104,15 +158,47 @@ struct FeatureBitmap {
 		return table;
 	}
 
+	// indexed by feature Index
+	const std::vector<FeatureStats> &feature_stats() const {
+		return stats;
+	}
+
+	bool is_tiled() const { return wide ? raster32.is_tiled() : raster16.is_tiled(); }
+
 	Index get_index(const FeatureRawVal &pixel);
+	// Same as above, for a value of raw_vals_size bytes.
+	Index get_index(const uint8_t *raw_val);
 	void dump_feature_table() const;
 	BitGrid get_mask_for_feature(Index wanted) const;
+	// Same as above, but cropped to the bounding box of the feature.  The
+	// position of the top-left corner of the crop is stored in off_x, off_y.
+	BitGrid get_cropped_mask_for_feature(Index wanted, int *off_x, int *off_y) const;
+	// Traces all features at once.  Element i of the result is the outline of
+	// the feature with index i.  The features are divided between up to
+	// num_threads threads.
+	std::vector<Mpoly> trace_features(int64_t min_area, int num_threads) const;
 
 private:
+	BitGrid get_mask_for_window(Index wanted, int x0, int y0, int mask_w, int mask_h) const;
+	void set_pixel(int x, int y, Index val) {
+		if(wide) raster32(x, y) = val;
+		else raster16(x, y) = uint16_t(val);
+	}
+	// switches from raster16 to raster32
+	void widen();
+
 	const size_t w, h;
 	const size_t raw_vals_size;
-	GridArray<Index> raster;
+	// NDV pixels are left as 0 in the raster, and so are part of feature 0
+	size_t num_ndv;
+	// Only one of these is used: raster32 if wide is set, otherwise raster16.
+	bool wide;
+	GridArray<uint16_t> raster16;
+	GridArray<uint32_t> raster32;
+	RawValIndex index;
+	// the same as index, but sorted by value
 	std::map<FeatureRawVal, Index> table;
+	std::vector<FeatureStats> stats;
 };
 
 } // namespace dangdal
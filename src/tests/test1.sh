@@ -1,6 +1,6 @@
 #!/bin/bash
 
-rm -f out_test1_*
+rm -f out_test1_* out_memlimit_test1_* out_threads_test1_* out_coarse_test1_* out_ll_*
 
 #BINDIR="valgrind -q .."
 BINDIR=..
@@ -108,6 +108,71 @@ $BINDIR/gdal_make_ndv_mask has_nan.tif out_test1_nan1.pbm -ndv 7
 $BINDIR/gdal_make_ndv_mask has_nan.tif out_test1_nan2.pbm -ndv 'Inf *'
 $BINDIR/gdal_make_ndv_mask has_nan.tif out_test1_nan3.pbm -ndv '* Inf'
 $BINDIR/gdal_make_ndv_mask has_nan.tif out_test1_nan4.pbm -ndv '* -Inf'
+# With no NDV at all, the NaN values are still NDV.
+$BINDIR/gdal_make_ndv_mask has_nan.tif out_test1_nan5.pbm
+
+# A tiled copy of testcase_3 with overviews, which -coarse-to-fine needs.  Its
+# edges are far enough apart that skipping blocks shouldn't change the output.
+python <<END
+import osgeo.gdal as gdal
+
+src_ds = gdal.Open('testcase_3.tif')
+dst_ds = gdal.GetDriverByName('GTiff').CreateCopy('testcase_3_tiled.tif', src_ds,
+    options=['TILED=YES', 'BLOCKXSIZE=32', 'BLOCKYSIZE=32'])
+dst_ds.BuildOverviews('NEAREST', [2, 4, 8])
+dst_ds = None
+END
+
+$BINDIR/gdal_trace_outline -coarse-to-fine testcase_3_tiled.tif -ndv 255 -out-cs xy -wkt-out out_coarse_test1_3.wkt -split-polys -dp-toler 0
+
+# The same again, with a memory limit low enough that the masks and feature
+# rasters are kept in temporary files (or, for plain traces, as runs).
+MEMLIMIT="-mem-limit 0.01"
+
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_1.tif -ndv 255 -out-cs xy -wkt-out out_memlimit_test1_1.wkt    -report out_memlimit_test1_1.ppm -split-polys -dp-toler 0
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_1.tif -ndv 255 -out-cs en -wkt-out out_memlimit_test1_1_en.wkt -dp-toler 0
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_2.tif -ndv 255 -out-cs xy -wkt-out out_memlimit_test1_2.wkt    -report out_memlimit_test1_2.ppm -split-polys -dp-toler 0
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_3.tif -ndv 255 -out-cs xy -wkt-out out_memlimit_test1_3.wkt    -report out_memlimit_test1_3.ppm -split-polys -dp-toler 0
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_4.png -ndv '0..255 0..255 0..255 0' -out-cs xy -wkt-out out_memlimit_test1_4.wkt    -report out_memlimit_test1_4.ppm -split-polys -dp-toler 0
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_5.png -ndv 255 -out-cs xy -wkt-out out_memlimit_test1_5.wkt    -report out_memlimit_test1_5.ppm -split-polys -dp-toler 0
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_maze.png  -ndv 255 -out-cs xy -wkt-out out_memlimit_test1_maze.wkt  -report out_memlimit_test1_maze.ppm  -split-polys -dp-toler 0
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_noise.png -b 1 -ndv   0 -out-cs xy -wkt-out out_memlimit_test1_noise.wkt -report out_memlimit_test1_noise.ppm -split-polys -dp-toler 0
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_noise.png -b 1 -ndv   0 -out-cs xy -wkt-out out_memlimit_test1_noise_dp3.wkt -report out_memlimit_test1_noise_dp3.ppm -split-polys -dp-toler 3
+
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_3.tif -out-cs xy -wkt-out out_memlimit_test1_3_classify.wkt -ogr-out out_memlimit_test1_3_classify.shp -dp-toler 0 -classify
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_3_paletted.tif -out-cs xy -wkt-out out_memlimit_test1_3_classify_pal.wkt -ogr-out out_memlimit_test1_3_classify_pal.shp -dp-toler 0 -classify
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_features.png -out-cs xy -wkt-out out_memlimit_test1_features.wkt -ogr-out out_memlimit_test1_features.shp -dp-toler 0 -classify
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_double.tif -out-cs xy -wkt-out out_memlimit_test1_double.wkt -ogr-out out_memlimit_test1_double.shp -dp-toler 0 -classify
+$BINDIR/gdal_trace_outline $MEMLIMIT testcase_double.tif -out-cs xy -wkt-out out_memlimit_test1_double_clip.wkt -dp-toler 0 -classify -valid-range '3..6'
+
+$BINDIR/gdal_make_ndv_mask $MEMLIMIT -ndv '155 52 52' -ndv '24 173 79'     testcase_3.tif out_memlimit_test1_3_ndvmask.pbm
+$BINDIR/gdal_make_ndv_mask $MEMLIMIT -ndv '155 52 52' -ndv '24 173 79.9..80.1' testcase_3.tif out_memlimit_test1_3_ndvmask2.pbm
+
+$BINDIR/gdal_make_ndv_mask $MEMLIMIT \
+    -ndv '10..30 30..70 *' \
+    -ndv '* * 4..Inf' \
+    -ndv '100..140 50..80 0.5..Inf' \
+    -ndv '* * 0.8..0.3' \
+    -ndv '* * 0.3..0.4' \
+    gradient3.tif out_memlimit_test1_gradient_ndv.pbm
+
+$BINDIR/gdal_make_ndv_mask $MEMLIMIT has_nan.tif out_memlimit_test1_nan1.pbm -ndv 7
+
+# The same again with several threads, which must not change the output.
+THREADS="-threads 4"
+
+$BINDIR/gdal_trace_outline $THREADS testcase_noise.png -b 1 -ndv   0 -out-cs xy -wkt-out out_threads_test1_noise.wkt -report out_threads_test1_noise.ppm -split-polys -dp-toler 0
+$BINDIR/gdal_trace_outline $THREADS testcase_noise.png -b 1 -ndv   0 -out-cs xy -wkt-out out_threads_test1_noise_dp3.wkt -report out_threads_test1_noise_dp3.ppm -split-polys -dp-toler 3
+
+$BINDIR/gdal_trace_outline $THREADS testcase_3.tif -out-cs xy -wkt-out out_threads_test1_3_classify.wkt -ogr-out out_threads_test1_3_classify.shp -dp-toler 0 -classify
+$BINDIR/gdal_trace_outline $THREADS testcase_3_paletted.tif -out-cs xy -wkt-out out_threads_test1_3_classify_pal.wkt -ogr-out out_threads_test1_3_classify_pal.shp -dp-toler 0 -classify
+$BINDIR/gdal_trace_outline $THREADS testcase_features.png -out-cs xy -wkt-out out_threads_test1_features.wkt -ogr-out out_threads_test1_features.shp -dp-toler 0 -classify
+$BINDIR/gdal_trace_outline $THREADS testcase_double.tif -out-cs xy -wkt-out out_threads_test1_double.wkt -ogr-out out_threads_test1_double.shp -dp-toler 0 -classify
+$BINDIR/gdal_trace_outline $THREADS testcase_double.tif -out-cs xy -wkt-out out_threads_test1_double_clip.wkt -dp-toler 0 -classify -valid-range '3..6'
+
+# There is no good output for -out-cs ll, so just check that threads don't change it.
+$BINDIR/gdal_trace_outline testcase_1.tif -ndv 255 -out-cs ll -wkt-out out_ll_threads1.wkt -dp-toler 0
+$BINDIR/gdal_trace_outline $THREADS testcase_1.tif -ndv 255 -out-cs ll -wkt-out out_ll_threads4.wkt -dp-toler 0
 
 echo '####################'
 
@@ -124,3 +189,19 @@ for i in good_test1_* ; do
 		echo "BAD ${i/good_/}"
 	fi
 done
+
+# Variants of the runs above must give the same output as the runs themselves.
+for i in out_memlimit_test1_* out_threads_test1_* out_coarse_test1_* ; do
+	good=good_${i#out_*_}
+	if diff --brief $good $i ; then
+		echo "GOOD ${i#out_}"
+	else
+		echo "BAD ${i#out_}"
+	fi
+done
+
+if diff --brief out_ll_threads1.wkt out_ll_threads4.wkt ; then
+	echo "GOOD ll_threads4.wkt"
+else
+	echo "BAD ll_threads4.wkt"
+fi
@@ -0,0 +1,155 @@
+/*
+Copyright (c) 2013, Regents of the University of Alaska
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of the Geographic Information Network of Alaska nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+This code was developed by Dan Stahlke for the Geographic Information Network of Alaska.
+*/
+
+
+
+
+
+#include <algorithm>
+#include <cassert>
+
+#include <cpl_conv.h>
+
+#include "common.h"
+#include "tiled-store.h"
+
+namespace dangdal {
+
+size_t GRID_MEMORY_LIMIT = 0;
+
+const size_t TiledStore::MIN_CACHED_TILES;
+
+// Tiles are made of as many rows as fit in this many bytes, or in a share of
+// the memory budget small enough that MIN_CACHED_TILES of them fit in it.
+static const size_t TILE_TARGET_BYTES = 1 << 20;
+
+TiledStore::TiledStore(size_t _row_bytes, size_t _num_rows, size_t mem_budget) :
+	row_bytes(_row_bytes),
+	num_rows(_num_rows),
+	cur_tile(size_t(-1)),
+	cur_slot(0),
+	fh(NULL),
+	unlinked(false)
+{
+	size_t target_bytes = std::min(TILE_TARGET_BYTES, mem_budget / MIN_CACHED_TILES);
+	rows_per_tile = std::max(size_t(1), target_bytes / std::max(row_bytes, size_t(1)));
+	rows_per_tile = std::min(rows_per_tile, std::max(num_rows, size_t(1)));
+	tile_bytes = rows_per_tile * row_bytes;
+
+	size_t num_tiles = (num_rows + rows_per_tile - 1) / rows_per_tile;
+	max_slots = std::max(MIN_CACHED_TILES, mem_budget / std::max(tile_bytes, size_t(1)));
+	max_slots = std::min(max_slots, std::max(num_tiles, size_t(1)));
+
+	tile_slot.resize(num_tiles, -1);
+	tile_on_disk.resize(num_tiles, false);
+	// Growing slots would move the tiles' data, and with it rows already
+	// handed out by get_row.
+	slots.reserve(max_slots);
+
+	if(VERBOSE) printf("tiled store: %zd tiles of %zd rows, caching %zd tiles\n",
+		num_tiles, rows_per_tile, max_slots);
+}
+
+TiledStore::~TiledStore() {
+	if(fh) {
+		VSIFCloseL(fh);
+		if(!unlinked) VSIUnlink(fn.c_str());
+	}
+}
+
+void TiledStore::clear() {
+	slots.clear();
+	lru.clear();
+	std::fill(tile_slot.begin(), tile_slot.end(), -1);
+	std::fill(tile_on_disk.begin(), tile_on_disk.end(), false);
+	cur_tile = size_t(-1);
+	cur_slot = 0;
+}
+
+void TiledStore::open_file() {
+	fn = CPLGenerateTempFilename("dangdal_tiles");
+	fh = VSIFOpenL(fn.c_str(), "w+b");
+	if(!fh) fatal_error("could not create temporary file %s", fn.c_str());
+	// On POSIX systems the file can be removed right away and will go away
+	// once closed, even if we exit through fatal_error.
+	unlinked = !VSIUnlink(fn.c_str());
+}
+
+void TiledStore::write_slot(Slot &slot) {
+	if(!fh) open_file();
+	vsi_l_offset off = vsi_l_offset(slot.tile) * tile_bytes;
+	if(VSIFSeekL(fh, off, SEEK_SET) ||
+		VSIFWriteL(&slot.data[0], tile_bytes, 1, fh) != 1
+	) {
+		fatal_error("could not write to temporary file %s", fn.c_str());
+	}
+	tile_on_disk[slot.tile] = true;
+	slot.dirty = false;
+}
+
+void TiledStore::load_tile(size_t tile) {
+	assert(tile < tile_slot.size());
+
+	if(tile_slot[tile] >= 0) {
+		cur_slot = tile_slot[tile];
+		lru.splice(lru.begin(), lru, slots[cur_slot].lru_pos);
+		cur_tile = tile;
+		return;
+	}
+
+	if(slots.size() < max_slots) {
+		cur_slot = slots.size();
+		slots.push_back(Slot());
+		slots[cur_slot].data.resize(tile_bytes);
+		lru.push_front(cur_slot);
+	} else {
+		cur_slot = lru.back();
+		lru.splice(lru.begin(), lru, --lru.end());
+		Slot &victim = slots[cur_slot];
+		if(victim.dirty) write_slot(victim);
+		tile_slot[victim.tile] = -1;
+	}
+
+	Slot &slot = slots[cur_slot];
+	slot.tile = tile;
+	slot.dirty = false;
+	slot.lru_pos = lru.begin();
+	tile_slot[tile] = cur_slot;
+	cur_tile = tile;
+
+	if(tile_on_disk[tile]) {
+		vsi_l_offset off = vsi_l_offset(tile) * tile_bytes;
+		if(VSIFSeekL(fh, off, SEEK_SET) ||
+			VSIFReadL(&slot.data[0], tile_bytes, 1, fh) != 1
+		) {
+			fatal_error("could not read from temporary file %s", fn.c_str());
+		}
+	} else {
+		std::fill(slot.data.begin(), slot.data.end(), 0);
+	}
+}
+
+} // namespace dangdal
@@ -0,0 +1,113 @@
+/*
+Copyright (c) 2013, Regents of the University of Alaska
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the name of the Geographic Information Network of Alaska nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+This code was developed by Dan Stahlke for the Geographic Information Network of Alaska.
+*/
+
+
+
+
+
+#ifndef DANGDAL_TILED_STORE_H
+#define DANGDAL_TILED_STORE_H
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <cpl_vsi.h>
+
+#include "common.h"
+
+namespace dangdal {
+
+// Grids (masks and feature rasters) that would take more than this many bytes
+// are kept in a TiledStore, with up to this many bytes of tiles cached in
+// memory for each grid.  Zero means no limit: grids are always kept in memory.
+extern size_t GRID_MEMORY_LIMIT;
+
+// Out-of-core storage for grids too big to fit in memory.  The rows of the grid
+// are grouped into fixed size tiles (strips of whole rows, so that each row
+// stays contiguous) which live in a temporary file.  A limited number of tiles
+// are kept in memory, and the least recently used one is written back to the
+// file when room is needed for another.  Tiles that have never been written
+// read back as zeros.
+class TiledStore : boost::noncopyable {
+public:
+	TiledStore(size_t _row_bytes, size_t _num_rows, size_t mem_budget);
+	~TiledStore();
+
+	// Returns a pointer to the given row.  The pointer remains valid until
+	// rows from MIN_CACHED_TILES-1 other tiles have been requested, so it is
+	// safe to hold onto a row and its neighbor at the same time.  If for_write
+	// is set, the tile will be written back to the file when evicted.
+	uint8_t *get_row(size_t y, bool for_write) {
+		size_t tile = y / rows_per_tile;
+		if(tile != cur_tile) load_tile(tile);
+		if(for_write) slots[cur_slot].dirty = true;
+		return &slots[cur_slot].data[(y - tile*rows_per_tile) * row_bytes];
+	}
+
+	// Resets every row to zero.
+	void clear();
+
+	static const size_t MIN_CACHED_TILES = 4;
+
+private:
+	struct Slot {
+		size_t tile;
+		bool dirty;
+		std::vector<uint8_t> data;
+		std::list<size_t>::iterator lru_pos;
+	};
+
+	void load_tile(size_t tile);
+	void write_slot(Slot &slot);
+	void open_file();
+
+	size_t row_bytes;
+	size_t num_rows;
+	size_t rows_per_tile;
+	size_t tile_bytes;
+	size_t max_slots;
+
+	std::vector<Slot> slots;
+	// slot holding each tile, or -1 if the tile is not in memory
+	std::vector<int> tile_slot;
+	std::vector<bool> tile_on_disk;
+	// slot indices, most recently used first
+	std::list<size_t> lru;
+
+	size_t cur_tile;
+	size_t cur_slot;
+
+	std::string fn;
+	VSILFILE *fh;
+	bool unlinked;
+};
+
+} // namespace dangdal
+
+#endif // ifndef DANGDAL_TILED_STORE_H